@@ -68,18 +68,30 @@ my $program = 'liv';
 my @sources = (qw(
     liv/app.cpp
     liv/commands.cpp
+    liv/compress.cpp
+    liv/disk-cache.cpp
+    liv/eviction.cpp
     liv/book-source.cpp
     liv/book-state.cpp
     liv/book-view.cpp
     liv/book.cpp
     liv/format.cpp
     liv/list.cpp
+    liv/listing.cpp
     liv/main.cpp
     liv/mark.cpp
     liv/page-block.cpp
+    liv/page-loader.cpp
+    liv/page-table.cpp
+    liv/page-uploader.cpp
     liv/page.cpp
+    liv/prefetch.cpp
+    liv/preload.cpp
+    liv/probe.cpp
+    liv/scan.cpp
     liv/settings.cpp
     liv/sort.cpp
+    liv/watch.cpp
     dirt/ayu/common.cpp
     dirt/ayu/data/parse.cpp
     dirt/ayu/data/print.cpp
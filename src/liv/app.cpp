@@ -59,6 +59,13 @@ static void on_event (App& self, SDL_Event* e) {
     current_app = null;
 }
 
+void wake_main_loop () {
+    static u32 type = SDL_RegisterEvents(1);
+    SDL_Event event = {};
+    event.type = type;
+    SDL_PushEvent(&event);
+}
+
 static bool on_idle (App& self) {
      // No more events?  Draw a book or do some background processing
     for (auto& book : self.books) {
@@ -95,6 +102,16 @@ App::App () : loop{
 
 App::~App () { }
 
+ // Listing pages can take a while for books that have to look through folders,
+ // so show a page first and list the rest in the background.
+static bool should_scan_in_background (const BookSource& src) {
+    if (src.type != BookType::Misc) return true;
+    for (auto& loc : src.locations) {
+        if (fs::is_directory(iri::to_fs_path(loc).c_str())) return true;
+    }
+    return false;
+}
+
 static void add_book (
     App& self, BookSource&& src,
     std::unique_ptr<Settings> settings
@@ -106,7 +123,11 @@ static void add_book (
         if (settings->parent == &builtin_default_settings) {
             settings->parent = self.app_settings;
         }
-        PageBlock block (src, *settings);
+        IRI start;
+        if (src.type == BookType::FileWithNeighbors) start = src.locations[0];
+        PageBlock block = should_scan_in_background(src)
+            ? PageBlock(src, *settings, start)
+            : PageBlock(src, *settings);
         BookState state (move(settings));
         if (src.type == BookType::FileWithNeighbors) {
             expect(src.locations.size() == 1);
@@ -12,6 +12,9 @@ BookState::BookState (std::unique_ptr<Settings> s) :
 { }
 
 IRange BookState::viewing_range () const {
+    if (settings->get(&LayoutSettings::continuous)) {
+        return IRange{page_offset, page_offset + strip_count};
+    }
     auto spread_count = settings->get(&LayoutSettings::spread_count);
     return IRange{page_offset, page_offset + spread_count};
 }
@@ -23,7 +26,8 @@ AYU_DESCRIBE(liv::BookState,
         attr("settings", &BookState::settings, collapse_optional),
         attr("page_offset", &BookState::page_offset),
         attr("manual_zoom", &BookState::manual_zoom, collapse_optional),
-        attr("manual_offset", &BookState::manual_offset, collapse_optional)
+        attr("manual_offset", &BookState::manual_offset, collapse_optional),
+        attr("reading_stats", &BookState::reading_stats, optional)
     )
 )
 
@@ -4,6 +4,7 @@
 #include "../dirt/uni/common.h"
 #include "common.h"
 #include "page.h"
+#include "preload.h"
 #include "settings.h"
 
 namespace liv {
@@ -22,6 +23,11 @@ struct BookState {
      // If not defined, use the auto zoom mode.
     std::optional<float> manual_zoom;
     std::optional<Vec> manual_offset;
+     // For predicting which pages to preload
+    ReadingStats reading_stats;
+     // In continuous mode, how many pages from page_offset are laid out.
+     // Maintained by BookView.
+    i32 strip_count = 1;
 
      // Pages currently being viewed, clamped to valid page indexes.
     IRange viewing_range () const;
@@ -44,7 +44,18 @@ Vec BookView::get_picture_size () {
     return picture_size;
 }
 
+static bool vertical (Direction dir) {
+    return dir == Direction::Down || dir == Direction::Up;
+}
+static bool reversed (Direction dir) {
+    return dir == Direction::Up || dir == Direction::Left;
+}
+
+static float fit_zoom (AutoZoomMode mode, Vec ps, Vec ss);
+static void gen_strip (BookView& self);
+
 void gen_spread (BookView& self) {
+    if (self.continuous()) return gen_strip(self);
     auto pages = UniqueArray<PageView>(Capacity(size(self.book->visible_range())));
     Vec size = {0, 0};
     auto& state = self.book->state;
@@ -53,7 +64,15 @@ void gen_spread (BookView& self) {
      // Collect visible pages
     for (i32 i : self.book->visible_range()) {
         if (Page* page = block.get(i)) {
-            block.load_page(page);
+             // Only count pages the first time they're shown, not when the
+             // spread is regenerated because a page finished loading.
+            bool was_visible = false;
+            for (auto& v : self.pages) {
+                if (v.page == page) { was_visible = true; break; }
+            }
+            if (!was_visible) block.count_view(page);
+             // Doesn't block.  We'll be notified when the page is ready.
+            block.load_visible_page(page, self.book);
             pages.emplace_back_expect_capacity(page, GNAN);
         }
     }
@@ -113,6 +132,99 @@ void gen_spread (BookView& self) {
     swap(self.pages, pages); // tail call deleter
 }
 
+bool BookView::continuous () {
+    return book->state.settings->get(&LayoutSettings::continuous);
+}
+
+float BookView::get_strip_lead (Vec offset) {
+    auto dir = book->state.settings->get(&LayoutSettings::spread_direction);
+    float o = vertical(dir) ? offset.y : offset.x;
+    Vec ps = get_picture_size();
+    float len = vertical(dir) ? ps.y : ps.x;
+    return (reversed(dir) ? o - len : -o) / get_zoom();
+}
+
+Vec BookView::set_strip_lead (Vec offset, float lead) {
+    auto dir = book->state.settings->get(&LayoutSettings::spread_direction);
+    Vec ps = get_picture_size();
+    float len = vertical(dir) ? ps.y : ps.x;
+    float o = reversed(dir) ? lead * get_zoom() + len : -lead * get_zoom();
+    if (vertical(dir)) offset.y = o;
+    else offset.x = o;
+    return offset;
+}
+
+float BookView::strip_extent (const Page* page) {
+    auto dir = book->state.settings->get(&LayoutSettings::spread_direction);
+    return vertical(dir) ? page->size.y : page->size.x;
+}
+
+ // The continuous version of gen_spread.  Lays out pages from the anchor page
+ // until they cover the window plus strip_margin.  spread_size is the size of
+ // the largest page, so zoom modes fit single pages instead of the whole
+ // strip.
+static void gen_strip (BookView& self) {
+    auto& state = self.book->state;
+    auto& block = self.book->block;
+    auto dir = state.settings->get(&LayoutSettings::spread_direction);
+    auto mode = state.settings->get(&LayoutSettings::auto_zoom_mode);
+    Vec ps = self.get_picture_size();
+    float len = vertical(dir) ? ps.y : ps.x;
+     // We can't use get_zoom or get_offset because they depend on the
+     // spread.  Scrolling sets a manual zoom, so usually that's all we need.
+    float lead = 0;
+    if (state.manual_zoom && state.manual_offset) {
+        float o = vertical(dir) ? state.manual_offset->y
+                                : state.manual_offset->x;
+        lead = (reversed(dir) ? o - len : -o) / *state.manual_zoom;
+    }
+     // First figure out how many pages we need.  Adding a page can make the
+     // largest page larger, which makes the auto zoom smaller, which means
+     // we need more pages.
+    i32 first = clamp(state.page_offset, 0, max(block.count() - 1, 0));
+    Vec box = {0, 0};
+    float pos = 0;
+    i32 end = first;
+    while (end < block.count() && end - first < max_strip_pages) {
+        Page* page = block.get(end++);
+        box.x = max<float>(box.x, page->size.x);
+        box.y = max<float>(box.y, page->size.y);
+        pos += self.strip_extent(page);
+        float zoom = state.manual_zoom ? *state.manual_zoom
+                   : area(box) ? fit_zoom(mode, ps, box) : 1;
+        if ((pos - lead) * zoom >= len * (1 + strip_margin)) break;
+    }
+     // Set this before loading, so the loader knows which pages are in view.
+    state.strip_count = max(end - first, 1);
+
+    auto pages = UniqueArray<PageView>(Capacity(end - first));
+    Vec small_align = state.settings->get(&LayoutSettings::small_align);
+    pos = 0;
+    for (i32 i = first; i < end; i++) {
+        Page* page = block.get(i);
+        bool was_visible = false;
+        for (auto& v : self.pages) {
+            if (v.page == page) { was_visible = true; break; }
+        }
+        if (!was_visible) block.count_view(page);
+        block.load_visible_page(page, self.book);
+        float ext = self.strip_extent(page);
+        float along = reversed(dir) ? -(pos + ext) : pos;
+        Vec offset;
+        if (vertical(dir)) {
+            offset = {(box.x - page->size.x) * small_align.x, along};
+        }
+        else {
+            offset = {along, (box.y - page->size.y) * small_align.y};
+        }
+        pages.emplace_back_expect_capacity(page, offset);
+        pos += ext;
+    }
+    self.need_spread = false;
+    self.spread_size = box;
+    swap(self.pages, pages);
+}
+
 Slice<PageView> BookView::get_pages () {
     if (need_spread) gen_spread(*this);
     return pages;
@@ -123,6 +235,33 @@ Vec BookView::get_spread_size () {
     return spread_size;
 }
 
+Vec BookView::get_max_page_size () {
+    auto& state = book->state;
+    if (state.manual_zoom) return {GINF, GINF};
+    Vec ps = get_picture_size();
+    switch (state.settings->get(&LayoutSettings::auto_zoom_mode)) {
+         // With any number of pages in the spread, no single page can be
+         // larger than the window in the fitted dimension.
+        case AutoZoomMode::Fit: return ps;
+        case AutoZoomMode::FitWidth: return {ps.x, GINF};
+        case AutoZoomMode::FitHeight: return {GINF, ps.y};
+        case AutoZoomMode::Original: return {GINF, GINF};
+        default: never();
+    }
+}
+
+static float fit_zoom (AutoZoomMode mode, Vec ps, Vec ss) {
+    switch (mode) {
+         // slope = 1 / aspect ratio
+        case AutoZoomMode::Fit:
+            return slope(ss) > slope(ps) ? ps.y / ss.y : ps.x / ss.x;
+        case AutoZoomMode::FitWidth: return ps.x / ss.x;
+        case AutoZoomMode::FitHeight: return ps.y / ss.y;
+        case AutoZoomMode::Original: return 1;
+        default: never();
+    }
+}
+
 float BookView::get_zoom () {
     if (!need_zoom) return zoom;
     auto& state = book->state;
@@ -139,31 +278,7 @@ float BookView::get_zoom () {
                 zoom = 1;
             }
             else {
-                auto ps = get_picture_size();
-                switch (state.settings->get(&LayoutSettings::auto_zoom_mode)) {
-                    case AutoZoomMode::Fit: {
-                         // slope = 1 / aspect ratio
-                        if (slope(ss) > slope(ps)) {
-                            zoom = ps.y / ss.y;
-                        }
-                        else {
-                            zoom = ps.x / ss.x;
-                        }
-                        zoom = clamp_zoom(zoom);
-                        break;
-                    }
-                    case AutoZoomMode::FitWidth: {
-                        zoom = ps.x / ss.x;
-                        zoom = clamp_zoom(zoom);
-                        break;
-                    }
-                    case AutoZoomMode::FitHeight: {
-                        zoom = ps.y / ss.y;
-                        zoom = clamp_zoom(zoom);
-                        break;
-                    }
-                    default: never();
-                }
+                zoom = clamp_zoom(fit_zoom(mode, get_picture_size(), ss));
             }
         }
     }
@@ -190,6 +305,8 @@ Vec BookView::get_offset () {
             range.y > 0 ? small_align.y : large_align.y
         };
         offset = range * align;
+         // Start at the beginning of the anchor page
+        if (continuous()) offset = set_strip_lead(offset, 0);
     }
     need_offset = false;
     return offset;
@@ -245,6 +362,31 @@ Vec BookView::clamp_offset (Vec req) {
     else {
         r.y = lerp(valid_lt.y, valid_rb.y, small_align.y);
     }
+    if (continuous()) {
+         // The spread is only the largest page, so redo the axis along the
+         // strip.  Only the ends of the book limit it.
+        auto& block = book->block;
+        auto dir = book->state.settings->get(&LayoutSettings::spread_direction);
+        float len = vertical(dir) ? ps.y : ps.x;
+        float z = get_zoom();
+        float lead = get_strip_lead(req);
+         // Look for the end of the book, but not past the window.
+        i32 first = book->state.page_offset;
+        float pos = 0;
+        bool at_end = true;
+        for (i32 i = first; i < block.count(); i++) {
+            if (i - first >= max_strip_pages || pos > lead + len / z) {
+                at_end = false;
+                break;
+            }
+            pos += strip_extent(block.get(i));
+        }
+        if (at_end) {
+            lead = min(lead, pos - len * (1 - scroll_margin) / z);
+        }
+        if (first <= 0) lead = max(lead, -len * scroll_margin / z);
+        r = set_strip_lead(r, lead);
+    }
     return r;
 }
 
@@ -300,7 +442,24 @@ bool BookView::draw_if_needed () {
         auto spread_pages = get_pages();
         float zoom = get_zoom();
         Vec offset = get_offset();
+         // Fetch full-resolution versions of pages that have been zoomed in
+         // past their downscaled size.  Allow a pixel of slop for rounding.
+        for (auto& v : spread_pages) {
+            Page* p = v.page;
+            if (p->state != PageState::Resident || !p->downscaled()) continue;
+            if (zoom * p->size.x > p->texture_size.x + 1 ||
+                zoom * p->size.y > p->texture_size.y + 1
+            ) {
+                book->block.upgrade_page(p, book);
+            }
+        }
+         // Tiles that aren't uploaded yet are left for finish_loads, which
+         // sends them through the uploader.
         draw_pages(spread_pages, *book->state.settings, picture_size, offset, zoom);
+        for (auto& v : spread_pages) {
+            book->block.resident_pages.touch(v.page);
+            book->block.ram_pages.touch(v.page);
+        }
         plog("drew view");
          // vsync
         SDL_GL_SwapWindow(window);
@@ -7,6 +7,13 @@
 
 namespace liv {
 
+ // Most pages the continuous layout will lay out at once, in case they're
+ // tiny or their sizes aren't known yet.
+constexpr i32 max_strip_pages = 64;
+ // The continuous layout lays out this many window lengths past the end of
+ // the window, so pages are loaded before they scroll into view.
+constexpr float strip_margin = 0.5;
+
  // Responsible for window management and drawing.
 struct BookView {
     explicit BookView (Book* book);
@@ -46,11 +53,27 @@ struct BookView {
     Vec get_spread_size ();
     float get_zoom ();
     Vec get_offset ();
+     // The largest size a single page could be shown at with the current
+     // layout and window size, without manual zooming.  Components are
+     // infinite if there's no limit.
+    Vec get_max_page_size ();
 
      // Restrict some properties based on current view
     float clamp_zoom (float);
     Vec clamp_offset (Vec);
 
+     // For the continuous layout setting.  The pages are laid out in a strip
+     // starting from the page at page_offset (the anchor page), so the layout
+     // never has to know about pages before it.
+    bool continuous ();
+     // How far the leading edge of the window (in spread_direction) is past
+     // the leading edge of the anchor page, in unzoomed pixels.
+    float get_strip_lead (Vec offset);
+     // Change offset so that get_strip_lead would return lead.
+    Vec set_strip_lead (Vec offset, float lead);
+     // Length of a page along spread_direction, in unzoomed pixels.
+    float strip_extent (const Page*);
+
      // change glViewport and update projection
     void window_size_changed (geo::IVec new_size);
      // Returns true if drawing was actually done.
@@ -2,6 +2,8 @@
 
 #include <SDL2/SDL_events.h>
 #include "../dirt/control/input.h"
+#include "../dirt/uni/time.h"
+#include "list.h"
 #include "mark.h"
 
 namespace liv {
@@ -109,13 +111,50 @@ void Book::on_event (SDL_Event* e) {
     }
 }
 
+ // In continuous mode, move the anchor page forward or back to the page under
+ // the leading edge of the window, and change offset to match so the view
+ // doesn't move.
+static Vec rebase_strip (Book& self, Vec offset) {
+    i32 old_offset = self.state.page_offset;
+    i32 i = old_offset;
+    for (;;) {
+        float lead = self.view.get_strip_lead(offset);
+        Page* page = self.block.get(i);
+        if (!page) break;
+        float ext = self.view.strip_extent(page);
+        if (lead > ext && i + 1 < self.block.count()) {
+            offset = self.view.set_strip_lead(offset, lead - ext);
+            i += 1;
+        }
+        else if (lead < 0 && i > 0) {
+            i -= 1;
+            ext = self.view.strip_extent(self.block.get(i));
+            offset = self.view.set_strip_lead(offset, lead + ext);
+        }
+        else break;
+    }
+    if (i != old_offset) {
+         // Not set_page_offset, because that would reset the offset.
+        self.state.page_offset = i;
+        self.block.planner.record_seek(
+            self.state.reading_stats, i - old_offset, now()
+        );
+        self.block.reschedule(&self);
+        self.view.update_spread();
+        self.delay_preload = false;
+    }
+    return offset;
+}
+
 void Book::set_page_offset (i32 off) {
     auto spread_count = state.settings->get(&LayoutSettings::spread_count);
+     // The strip always starts at its first page.
+    if (view.continuous()) spread_count = 1;
      // Clamp such that there is at least one visible page in the range
     state.page_offset = clamp(
         off,
         1 - i32(spread_count),
-        i32(block.pages.size()) - 1
+        block.count() - 1
     );
     switch (state.settings->get(&LayoutSettings::reset_on_seek)) {
         case ResetOnSeek::Zoom:
@@ -129,6 +168,7 @@ void Book::set_page_offset (i32 off) {
         case ResetOnSeek::None: break;
         default: never();
     }
+    block.reschedule(this);
 }
 
 void Book::next () {
@@ -141,6 +181,7 @@ void Book::prev () {
 
 void Book::seek (i32 offset) {
     set_page_offset(state.page_offset + offset);
+    block.planner.record_seek(state.reading_stats, offset, now());
     view.update_spread();
     need_mark = true;
     delay_preload = false;
@@ -158,6 +199,21 @@ void Book::go (Direction dir, i32 offset) {
     else if (dir == -spread_dir) seek(-offset);
 }
 
+bool Book::go_to_file (Str path) {
+    UniqueString full;
+    if (path && path[0] == '/') full = path;
+    else {
+        auto visible = visible_range();
+        if (!size(visible)) return false;
+        full = cat(block.table.folder(visible.l), path);
+    }
+     // Uses the block's index, so this doesn't depend on the page count.
+    i32 i = block.table.find_path(normalize_path(full));
+    if (i < 0) return false;
+    seek(i - state.page_offset);
+    return true;
+}
+
 void Book::trap_pointer (bool trap) {
     pointer_trapped = trap;
     SDL_SetRelativeMouseMode(trap ? SDL_TRUE : SDL_FALSE);
@@ -166,8 +222,7 @@ void Book::trap_pointer (bool trap) {
 void Book::remove_current_page () {
     auto visible = visible_range();
     if (!size(visible)) return;
-    block.unload_page(block.get(visible.l));
-    block.pages.erase(visible.l);
+    block.erase(visible.l);
      // Reclamp page offset
     set_page_offset(state.page_offset);
     view.update_spread();
@@ -178,16 +233,12 @@ void Book::remove_current_page () {
 void Book::sort (SortMethod method) {
     auto visible = visible_range();
     IRI current_location = size(visible)
-        ? block.pages[visible.l]->location
+        ? block.location(visible.l)
         : IRI();
     block.resort(method);
     if (current_location) {
-        for (u32 i = 0; i < size(block.pages); i++) {
-            if (block.pages[i]->location == current_location) {
-                set_page_offset(i);
-                break;
-            }
-        }
+        i32 i = block.find(current_location);
+        if (i >= 0) set_page_offset(i);
     }
     view.update_spread();
     need_mark = true;
@@ -198,6 +249,7 @@ void Book::spread_count (i32 count) {
     state.settings->layout.spread_count = {
         clamp(count, 1, LayoutSettings::max_spread_count)
     };
+    state.settings->layout.continuous = {false};
     view.update_spread();
     need_mark = true;
     delay_preload = false;
@@ -209,6 +261,16 @@ void Book::spread_direction (Direction dir) {
     need_mark = true;
 }
 
+void Book::continuous (bool on) {
+    state.settings->layout.continuous = {on};
+    state.manual_offset = {};
+     // Reclamp page offset
+    set_page_offset(state.page_offset);
+    view.update_spread();
+    need_mark = true;
+    delay_preload = false;
+}
+
 void Book::auto_zoom_mode (AutoZoomMode mode) {
     state.settings->layout.auto_zoom_mode = {mode};
     state.manual_zoom = {};
@@ -321,9 +383,18 @@ void Book::color_range (const ColorRange& range) {
 
 void Book::scroll (Vec amount) {
     state.manual_zoom = {view.get_zoom()};
-    state.manual_offset = {view.clamp_offset(view.get_offset() + amount)};
+    Vec offset = view.get_offset() + amount;
+    if (view.continuous()) {
+         // Clamping at the end of the book can pull the window back before
+         // the anchor page, so rebase again after.
+        offset = view.clamp_offset(rebase_strip(*this, offset));
+        offset = rebase_strip(*this, offset);
+    }
+    state.manual_offset = {view.clamp_offset(offset)};
     view.update_zoom();
     view.update_offset();
+     // Which pages are laid out depends on the offset.
+    if (view.continuous()) view.update_spread();
     need_mark = true;
 }
 
@@ -333,10 +404,22 @@ bool Book::idle_processing (const App& app) {
         save_mark(app, *this);
         return true;
     }
+    if (block.finish_scan(this)) return true;
+    if (block.finish_watch(this)) return true;
+     // Finish pages that are already loading even if we aren't preloading,
+     // because they might be visible.
+    if (block.finish_loads(this)) return true;
+    if (block.finish_probes(this)) return true;
     if (delay_preload) return false;
     return block.idle_processing(this, *state.settings);
 }
 
+void Book::wait_for_loads () {
+    block.wait_for_scan(this);
+    view.get_pages();
+    block.wait_for_loads(this);
+}
+
 } using namespace liv;
 
 #ifndef TAP_DISABLE_TESTS
@@ -364,6 +447,7 @@ static tap::TestSet tests ("liv/book", []{
     BookState state (move(settings));
     Book book (move(src), move(block), move(state));
 
+    book.wait_for_loads();
     book.view.draw_if_needed();
     glow::UniqueImage img (size);
     glFinish();
@@ -372,6 +456,7 @@ static tap::TestSet tests ("liv/book", []{
     is(img[{60, 60}], glow::RGBA8(0x2674dbff), "First page is correct");
 
     book.next();
+    book.wait_for_loads();
     book.view.draw_if_needed();
     glFinish();
     glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, img.pixels);
@@ -383,7 +468,20 @@ static tap::TestSet tests ("liv/book", []{
     book.seek(10000);
     is(book.state.page_offset, 1, "Can't seek past last page");
 
+    ok(book.go_to_file("image.png"), "go_to_file with a relative filename");
+    is(book.state.page_offset, 0, "go_to_file goes to the right page");
+    ok(book.go_to_file("../test/./image2.png"), "go_to_file normalizes path");
+    is(book.state.page_offset, 1, "go_to_file with .. goes to the right page");
+    ok(book.go_to_file(iri::to_fs_path(book.block.location(0))),
+        "go_to_file with an absolute path"
+    );
+    is(book.state.page_offset, 0, "go_to_file absolute goes to the right page");
+    ok(!book.go_to_file("nothing.png"), "go_to_file fails for a missing file");
+    is(book.state.page_offset, 0, "Failed go_to_file stays on the same page");
+    book.seek(1);
+
     book.prev();
+    book.wait_for_loads();
     book.view.draw_if_needed();
     glFinish();
     glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, img.pixels);
@@ -405,6 +503,7 @@ static tap::TestSet tests ("liv/book", []{
     book.spread_count(2);
     book.set_page_offset(0);
     is(book.visible_range(), IRange{0, 2}, "Two visible pages");
+    book.wait_for_loads();
     book.view.draw_if_needed();
     is(book.view.pages.size(), usize(2), "Spread has two pages");
     is(book.view.pages[1].offset.x, 7, "Spread second page has correct offset");
@@ -425,6 +524,47 @@ static tap::TestSet tests ("liv/book", []{
     book.next();
     is(book.visible_range(), IRange{1, 2}, "visible_range cannot go off the end");
 
+    book.spread_direction(Direction::Down);
+    book.continuous(true);
+    book.set_page_offset(0);
+    book.set_zoom(30);
+    book.view.draw_if_needed();
+    is(book.visible_range(), IRange{0, 2}, "Continuous mode lays out enough pages");
+    is(book.view.pages[1].offset.y, 5, "Continuous mode stacks pages");
+    book.scroll({0, -200});
+    is(book.state.page_offset, 1, "Scrolling past a page moves the anchor");
+    is(book.view.get_strip_lead(book.view.get_offset()), 1,
+        "Scrolling stops at the end of the strip"
+    );
+    book.wait_for_loads();
+    book.view.draw_if_needed();
+    glFinish();
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, img.pixels);
+    is(img[{60, 60}], glow::RGBA8(0x45942eff), "Continuous scroll shows second page");
+    book.scroll({0, 200});
+    is(book.state.page_offset, 0, "Scrolling back moves the anchor back");
+    is(book.view.get_strip_lead(book.view.get_offset()), 0,
+        "Scrolling stops at the start of the strip"
+    );
+
+    auto settings2 = std::make_unique<Settings>();
+    settings2->window.size = {size};
+    settings2->parent = app.app_settings;
+    auto src2 = BookSource(
+        BookType::FileWithNeighbors, Slice<IRI>{
+            IRI("res/liv/test/image2.png", iri::program_location())
+        }
+    );
+    PageBlock block2 (src2, *settings2, src2.locations[0]);
+    is(block2.count(), 1, "Background listing starts with the requested page");
+    BookState state2 (move(settings2));
+    Book book2 (move(src2), move(block2), move(state2));
+    ok(book2.block.scanning(), "Book is still listing pages");
+    book2.wait_for_loads();
+    ok(!book2.block.scanning(), "Book is done listing pages");
+    is(book2.block.count(), 2, "Background listing finds the other pages");
+    is(book2.state.page_offset, 1, "Book stays on the requested page");
+
     done_testing();
 });
 
@@ -45,7 +45,7 @@ struct Book {
     ~Book () { }
 
     IRange visible_range () {
-        return state.viewing_range() & IRange{0, block.pages.size()};
+        return state.viewing_range() & IRange{0, block.count()};
     }
 
     void on_event (SDL_Event*);
@@ -57,11 +57,15 @@ struct Book {
     void seek (i32);
     void go_next (Direction);
     void go (Direction, i32);
+     // Go to the page for this file.  A relative path is relative to the
+     // current page's folder.  Returns false if no page has that file.
+    bool go_to_file (Str path);
     void trap_pointer (bool);
     void remove_current_page ();
     void sort (SortMethod);
     void spread_count (i32);
     void spread_direction (Direction);
+    void continuous (bool);
     void auto_zoom_mode (AutoZoomMode);
     void set_zoom (float);
     void zoom (float);
@@ -81,6 +85,10 @@ struct Book {
      // Preload pages perhaps
      // Returns true if any processing was actually done.
     bool idle_processing (const App&);
+
+     // For testing.  Finish listing pages, then request the visible pages and
+     // block until they (and any other requested pages) are loaded.
+    void wait_for_loads ();
 };
 
 } // namespace liv
@@ -184,6 +184,14 @@ static void go (Direction dir, int32 count) {
 }
 CONTROL_COMMAND(go, 2, "Move in the given direction by the given number of pages")
 
+static void go_to_file (const AnyString& path) {
+    if (!current_book) return;
+    if (!current_book->go_to_file(path)) {
+        ayu::warn_utf8(cat("No page in this book has the file ", path, "\n"));
+    }
+}
+CONTROL_COMMAND(go_to_file, 1, "Go to the page for a file")
+
 static void trap_pointer (bool trap) {
     if (current_book) current_book->trap_pointer(trap);
 }
@@ -201,6 +209,11 @@ static void spread_direction (Direction dir) {
 }
 CONTROL_COMMAND(spread_direction, 1, "Change direction to read book in")
 
+static void continuous (bool on) {
+    if (current_book) current_book->continuous(on);
+}
+CONTROL_COMMAND(continuous, 1, "Lay out all pages in one continuous strip")
+
 static void auto_zoom_mode (AutoZoomMode mode) {
     if (current_book) current_book->auto_zoom_mode(mode);
 }
@@ -283,7 +296,7 @@ static void add_to_list (const AnyString& list, SortMethod sort) {
     if (!size(visible)) return;
 
     auto loc = iri::from_fs_path(list);
-    const IRI& entry = current_book->block.pages[visible.l]->location;
+    const IRI& entry = current_book->block.location(visible.l);
     add_to_list(loc, entry, sort);
 }
 CONTROL_COMMAND(add_to_list, 2, "Add current page filename to a list file and sort it")
@@ -293,7 +306,7 @@ static void remove_from_list (const AnyString& list) {
     auto visible = current_book->visible_range();
     if (!size(visible)) return;
     auto loc = iri::from_fs_path(list);
-    const IRI& entry = current_book->block.pages[visible.l]->location;
+    const IRI& entry = current_book->block.location(visible.l);
     liv::remove_from_list(loc, entry);
 }
 CONTROL_COMMAND(remove_from_list, 1, "Remove current page from list file")
@@ -308,7 +321,7 @@ static void move_to_folder (const AnyString& folder) {
     if (!current_book) return;
     auto visible = current_book->visible_range();
     if (!size(visible)) return;
-    auto& loc = current_book->block.pages[visible.l]->location;
+    auto loc = current_book->block.location(visible.l);
     auto new_path = cat(folder, '/', iri::path_filename(loc.path()));
     fs::rename(iri::to_fs_path(loc), new_path);
 }
@@ -19,18 +19,32 @@ using namespace geo;
 using namespace uni;
 namespace fs = std::filesystem;
 struct App;
+struct BackgroundScan;
 struct Book;
 struct BookSource;
 struct BookState;
 struct BookView;
+struct CompressedImage;
+struct DecodedImage;
+struct FolderWatcher;
 struct FormatList;
 struct FormatToken;
 struct Mark;
 struct Page;
 struct PageBlock;
+struct PageLoader;
+struct PageTile;
+struct PageUploader;
+struct Prefetcher;
+struct Prober;
 struct Settings;
 struct SortMethod;
 
+ // Wake up the main loop if it's waiting for events.  Can be called from any
+ // thread.  Everything shares one event type, since the main loop only has to
+ // know to look at its background work again.
+void wake_main_loop ();
+
 #ifdef LIV_PROFILE
 inline void plog (const char* s) {
     struct timespec t;
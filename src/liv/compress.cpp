@@ -0,0 +1,255 @@
+#include "compress.h"
+
+#include <cstring>
+
+namespace liv {
+
+ // See https://qoiformat.org/qoi-specification.pdf.  We don't write the file
+ // header or end marker, since we keep the size and format ourselves.
+ // Grayscale formats are expanded to RGBA while compressing and shrunk back
+ // while decompressing.
+
+static constexpr u8 QOI_OP_INDEX = 0x00;
+static constexpr u8 QOI_OP_DIFF = 0x40;
+static constexpr u8 QOI_OP_LUMA = 0x80;
+static constexpr u8 QOI_OP_RUN = 0xc0;
+static constexpr u8 QOI_OP_RGB = 0xfe;
+static constexpr u8 QOI_OP_RGBA = 0xff;
+static constexpr u8 QOI_MASK = 0xc0;
+
+struct Pixel {
+    u8 r, g, b, a;
+    bool operator== (const Pixel&) const = default;
+};
+
+static u32 pixel_hash (Pixel p) {
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+static Pixel read_pixel (const u8* p, PixelFormat format) {
+    switch (format) {
+        case PixelFormat::Gray8: return {p[0], p[0], p[0], 255};
+        case PixelFormat::GrayAlpha8: return {p[0], p[0], p[0], p[1]};
+        case PixelFormat::RGB8: return {p[0], p[1], p[2], 255};
+        case PixelFormat::RGBA8: return {p[0], p[1], p[2], p[3]};
+        default: never();
+    }
+}
+
+static void write_pixel (u8* p, PixelFormat format, Pixel px) {
+    switch (format) {
+        case PixelFormat::Gray8: p[0] = px.r; break;
+        case PixelFormat::GrayAlpha8: p[0] = px.r; p[1] = px.a; break;
+        case PixelFormat::RGB8: p[0] = px.r; p[1] = px.g; p[2] = px.b; break;
+        case PixelFormat::RGBA8: {
+            p[0] = px.r; p[1] = px.g; p[2] = px.b; p[3] = px.a; break;
+        }
+        default: never();
+    }
+}
+
+CompressedImage compress_image (const DecodedImage& img) {
+    expect(img);
+    u32 bpp = bytes_per_pixel(img.format);
+    usize pixel_count = area(img.size);
+     // Worst case is QOI_OP_RGBA for every pixel.
+    auto buf = std::unique_ptr<u8[]>(new u8 [pixel_count * 5]);
+    u8* out = &buf[0];
+
+    Pixel index [64] = {};
+    Pixel prev = {0, 0, 0, 255};
+    u32 run = 0;
+    for (i32 y = 0; y < img.size.y; y++) {
+        const u8* row = img.pixels + usize(y) * img.stride;
+        for (i32 x = 0; x < img.size.x; x++) {
+            Pixel px = read_pixel(row + usize(x) * bpp, img.format);
+            if (px == prev) {
+                run += 1;
+                if (run == 62) {
+                    *out++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            u32 h = pixel_hash(px);
+            if (index[h] == px) {
+                *out++ = QOI_OP_INDEX | h;
+            }
+            else {
+                index[h] = px;
+                if (px.a == prev.a) {
+                    i8 vr = i8(px.r - prev.r);
+                    i8 vg = i8(px.g - prev.g);
+                    i8 vb = i8(px.b - prev.b);
+                    i8 vg_r = i8(vr - vg);
+                    i8 vg_b = i8(vb - vg);
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2
+                     && vb > -3 && vb < 2
+                    ) {
+                        *out++ = QOI_OP_DIFF
+                               | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    }
+                    else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+                          && vg_b > -9 && vg_b < 8
+                    ) {
+                        *out++ = QOI_OP_LUMA | (vg + 32);
+                        *out++ = (vg_r + 8) << 4 | (vg_b + 8);
+                    }
+                    else {
+                        *out++ = QOI_OP_RGB;
+                        *out++ = px.r;
+                        *out++ = px.g;
+                        *out++ = px.b;
+                    }
+                }
+                else {
+                    *out++ = QOI_OP_RGBA;
+                    *out++ = px.r;
+                    *out++ = px.g;
+                    *out++ = px.b;
+                    *out++ = px.a;
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run) *out++ = QOI_OP_RUN | (run - 1);
+
+    CompressedImage r;
+    r.size = img.size;
+    r.original_size = img.original_size;
+    r.format = img.format;
+    r.data_size = out - &buf[0];
+     // Don't keep the worst-case allocation around
+    r.data = std::unique_ptr<u8[]>(new u8 [r.data_size]);
+    std::memcpy(&r.data[0], &buf[0], r.data_size);
+    return r;
+}
+
+DecodedImage decompress_image (const CompressedImage& img) {
+    u32 bpp = bytes_per_pixel(img.format);
+    expect(bpp);
+    usize stride = usize(img.size.x) * bpp;
+    u8* pixels = new u8 [stride * img.size.y];
+
+    const u8* in = &img.data[0];
+    const u8* end = in + img.data_size;
+    Pixel index [64] = {};
+    Pixel px = {0, 0, 0, 255};
+    u32 run = 0;
+    usize pixel_count = area(img.size);
+    for (usize i = 0; i < pixel_count; i++) {
+        if (run) run -= 1;
+        else {
+            require(in < end);
+            u8 b1 = *in++;
+            if (b1 == QOI_OP_RGB) {
+                px.r = in[0]; px.g = in[1]; px.b = in[2];
+                in += 3;
+            }
+            else if (b1 == QOI_OP_RGBA) {
+                px.r = in[0]; px.g = in[1]; px.b = in[2]; px.a = in[3];
+                in += 4;
+            }
+            else switch (b1 & QOI_MASK) {
+                case QOI_OP_INDEX: px = index[b1]; break;
+                case QOI_OP_DIFF: {
+                    px.r += ((b1 >> 4) & 3) - 2;
+                    px.g += ((b1 >> 2) & 3) - 2;
+                    px.b += (b1 & 3) - 2;
+                    break;
+                }
+                case QOI_OP_LUMA: {
+                    u8 b2 = *in++;
+                    i32 vg = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                    break;
+                }
+                case QOI_OP_RUN: run = b1 & 0x3f; break;
+                default: never();
+            }
+            index[pixel_hash(px)] = px;
+        }
+        write_pixel(pixels + i * bpp, img.format, px);
+    }
+
+    DecodedImage r;
+    r.size = img.size;
+    r.original_size = img.original_size;
+    r.format = img.format;
+    r.stride = stride;
+    r.pixels = pixels;
+    r.storage = std::shared_ptr<const void>(pixels, [](const void* p){
+        delete[] (const u8*)p;
+    });
+    return r;
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/iri/path.h"
+#include "../dirt/tap/tap.h"
+
+static bool same_pixels (const DecodedImage& a, const DecodedImage& b) {
+    if (a.size != b.size || a.format != b.format) return false;
+    usize row_bytes = usize(a.size.x) * bytes_per_pixel(a.format);
+    for (i32 y = 0; y < a.size.y; y++) {
+        if (std::memcmp(
+            a.pixels + y * a.stride, b.pixels + y * b.stride, row_bytes
+        ) != 0) return false;
+    }
+    return true;
+}
+
+static tap::TestSet tests ("liv/compress", []{
+    using namespace tap;
+
+    DecodedImage img = decode_image(iri::to_fs_path(
+        IRI("res/liv/test/image.png", iri::program_location())
+    ));
+    CompressedImage c = compress_image(img);
+    ok(c.data_size < area(img.size) * bytes_per_pixel(img.format),
+        "Flat image compresses"
+    );
+    ok(same_pixels(decompress_image(c), img), "Flat image round-trips");
+
+     // Something to exercise all the ops
+    for (PixelFormat format : {
+        PixelFormat::Gray8, PixelFormat::GrayAlpha8,
+        PixelFormat::RGB8, PixelFormat::RGBA8
+    }) {
+        u32 bpp = bytes_per_pixel(format);
+        IVec size = {67, 41};
+        auto pixels = std::shared_ptr<u8[]>(new u8 [area(size) * bpp]);
+        u32 seed = 12345;
+        for (usize i = 0; i < usize(area(size)) * bpp; i++) {
+            seed = seed * 1103515245 + 12345;
+            u32 noise = (seed >> 16) & 0xff;
+            usize p = i / bpp;
+            pixels[i] = p % 7 == 0 ? noise  // Large jumps
+                      : p % 5 == 0 ? u8(p / 3)  // Small diffs
+                      : p % 3 == 0 ? u8(i)  // Repeated colors
+                      : 200;  // Runs
+        }
+        DecodedImage src;
+        src.size = size;
+        src.original_size = size;
+        src.format = format;
+        src.stride = size.x * bpp;
+        src.pixels = &pixels[0];
+        src.storage = pixels;
+        ok(same_pixels(decompress_image(compress_image(src)), src),
+            cat("Noisy image round-trips with ", bpp, " channels")
+        );
+    }
+
+    done_testing();
+});
+#endif
@@ -0,0 +1,27 @@
+ // Fast lossless compression of decoded pages, for keeping pages in system
+ // memory after their textures are evicted.  Uses the QOI algorithm, which
+ // compresses about as well as PNG's fastest settings at many times the speed.
+
+#pragma once
+
+#include <memory>
+#include "../dirt/geo/vec.h"
+#include "../dirt/uni/common.h"
+#include "common.h"
+#include "page-loader.h"
+
+namespace liv {
+
+struct CompressedImage {
+    IVec size;
+    IVec original_size;
+    PixelFormat format = PixelFormat::None;
+    std::unique_ptr<u8[]> data;
+    usize data_size = 0;
+};
+
+ // Safe to call from any thread.
+CompressedImage compress_image (const DecodedImage&);
+DecodedImage decompress_image (const CompressedImage&);
+
+} // namespace liv
@@ -0,0 +1,455 @@
+#include "disk-cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/hash.h"
+#include "../dirt/uni/io.h"
+#include "../dirt/uni/text.h"
+
+namespace liv {
+
+ // Pyramids stop when the next level would be smaller than this in both
+ // dimensions.
+static constexpr i32 smallest_level = 256;
+static constexpr u32 max_levels = 32;
+static constexpr usize level_alignment = 4096;
+
+ // All levels are tightly packed rows of the image's pixel format, starting at
+ // level_offsets[i].  The header is followed by the image's filename, for
+ // debugging.  Page cache files have only one level.
+struct CacheHeader {
+    char magic [8];
+    u64 file_dev;
+    u64 file_ino;
+    i64 file_size;
+    i64 file_mtime;
+    i32 width;
+    i32 height;
+    u32 format;
+    u32 level_count;
+    u32 filename_size;
+    u32 reserved;
+    u64 level_offsets [max_levels];
+};
+
+static constexpr char cache_magic [8] = {'L','I','V','P','Y','R','0','2'};
+
+struct FileKey {
+    u64 dev;
+    u64 ino;
+    i64 size;
+    i64 mtime;  // nanoseconds
+};
+
+static bool get_file_key (const UniqueString& filename, FileKey& key) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return false;
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+    key.mtime = i64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+static UniqueString get_cache_path (
+    const UniqueString& folder, Str key_string, Str extension
+) {
+    u64 hash = uni::hash64(key_string);
+    char hex [16];
+    for (usize i = 0; i < 16; i++) {
+        hex[i] = uni::to_hex_digit(hash >> 60);
+        hash <<= 4;
+    }
+    return cat(folder, '/', Str(hex, 16), extension);
+}
+
+static UniqueString get_pyramid_path (
+    const UniqueString& folder, const UniqueString& filename, const FileKey& key
+) {
+    return get_cache_path(
+        folder, cat(filename, '|', key.size, '|', key.mtime), ".pyr"
+    );
+}
+
+static UniqueString get_page_path (
+    const UniqueString& folder, const FileKey& key
+) {
+    return get_cache_path(
+        folder,
+        cat(key.dev, '|', key.ino, '|', key.size, '|', key.mtime),
+        ".px"
+    );
+}
+
+static IVec half_size (IVec size) {
+    return IVec(max(size.x / 2, 1), max(size.y / 2, 1));
+}
+
+static usize align_up (usize n) {
+    return (n + level_alignment - 1) / level_alignment * level_alignment;
+}
+
+static DecodedImage read_cache_file (
+    const UniqueString& path, const FileKey& key, Vec max_size
+) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return {};
+    struct stat st;
+    if (fstat(fd, &st) != 0 || usize(st.st_size) < sizeof(CacheHeader)) {
+        close(fd);
+        return {};
+    }
+    usize map_size = st.st_size;
+    void* map = mmap(null, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return {};
+    auto storage = std::shared_ptr<const void>(map, [map_size](const void* p){
+        munmap(const_cast<void*>(p), map_size);
+    });
+
+    auto& h = *(const CacheHeader*)map;
+    auto format = PixelFormat(h.format);
+    u32 bpp = bytes_per_pixel(format);
+    if (std::memcmp(h.magic, cache_magic, 8) != 0
+     || h.file_dev != key.dev || h.file_ino != key.ino
+     || h.file_size != key.size || h.file_mtime != key.mtime
+     || h.width <= 0 || h.height <= 0 || !bpp
+     || h.level_count < 1 || h.level_count > max_levels
+    ) return {};
+
+     // Find the smallest level that doesn't need upscaling.  It's used as is
+     // rather than downscaled the rest of the way, so only the pages of the
+     // mapping that get uploaded are read.
+    IVec full_size = IVec(h.width, h.height);
+    IVec target = full_size;
+    float scale = min(max_size.x / full_size.x, max_size.y / full_size.y);
+    if (scale < 1) {
+        target = IVec(
+            max(i32(1), i32(std::round(full_size.x * scale))),
+            max(i32(1), i32(std::round(full_size.y * scale)))
+        );
+    }
+    u32 level = 0;
+    IVec level_size = full_size;
+    while (level + 1 < h.level_count) {
+        IVec next = half_size(level_size);
+        if (next.x < target.x || next.y < target.y) break;
+        level += 1;
+        level_size = next;
+    }
+    usize offset = h.level_offsets[level];
+    usize stride = usize(level_size.x) * bpp;
+    if (offset + stride * level_size.y > map_size) return {};
+
+     // Mark as recently used for garbage collection.
+    utimensat(AT_FDCWD, path.c_str(), null, 0);
+
+    DecodedImage r;
+    r.size = level_size;
+    r.original_size = full_size;
+    r.format = format;
+    r.stride = stride;
+    r.pixels = (const u8*)map + offset;
+    r.storage = move(storage);
+    return r;
+}
+
+DecodedImage read_cached_pyramid (
+    const UniqueString& folder, const UniqueString& filename, Vec max_size
+) {
+    FileKey key;
+    if (!get_file_key(filename, key)) return {};
+    return read_cache_file(
+        get_pyramid_path(folder, filename, key), key, max_size
+    );
+}
+
+DecodedImage read_cached_page (
+    const UniqueString& folder, const UniqueString& filename, Vec max_size
+) {
+    FileKey key;
+    if (!get_file_key(filename, key)) return {};
+     // There's only one level, so the page has to be shrunk from it.
+    return fit_image(
+        read_cache_file(get_page_path(folder, key), key, max_size), max_size
+    );
+}
+
+static void write_all (int fd, const void* data, usize size) {
+    auto p = (const u8*)data;
+    while (size) {
+        isize n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            raise(e_General, cat(
+                "Could not write cache file: ", std::strerror(errno)
+            ));
+        }
+        p += n;
+        size -= n;
+    }
+}
+
+static void write_zeros (int fd, usize size) {
+    static constexpr u8 zeros [level_alignment] = {};
+    while (size) {
+        usize n = min(size, level_alignment);
+        write_all(fd, zeros, n);
+        size -= n;
+    }
+}
+
+static void write_cache_file (
+    const UniqueString& folder, const UniqueString& path,
+    const UniqueString& filename, const FileKey& key,
+    const DecodedImage& full, u32 level_limit
+) {
+    expect(full);
+    expect(full.size == full.original_size);
+    u32 bpp = bytes_per_pixel(full.format);
+
+     // Make all the levels first, so a failure doesn't leave a partial file.
+    UniqueArray<DecodedImage> levels;
+    levels.emplace_back(full);
+    while (levels.size() < level_limit) {
+        IVec size = levels.back().size;
+        if (size.x <= smallest_level && size.y <= smallest_level) break;
+        levels.emplace_back(downscale_image(levels.back(), half_size(size)));
+    }
+
+    CacheHeader h = {};
+    std::memcpy(h.magic, cache_magic, 8);
+    h.file_dev = key.dev;
+    h.file_ino = key.ino;
+    h.file_size = key.size;
+    h.file_mtime = key.mtime;
+    h.width = full.size.x;
+    h.height = full.size.y;
+    h.format = u32(full.format);
+    h.level_count = levels.size();
+    h.filename_size = filename.size();
+    usize pos = align_up(sizeof(CacheHeader) + filename.size());
+    for (usize i = 0; i < levels.size(); i++) {
+        h.level_offsets[i] = pos;
+        pos = align_up(pos + area(levels[i].size) * usize(bpp));
+    }
+
+    std::error_code code;
+    fs::create_directories(folder.c_str(), code);
+     // Write to a temporary file and rename, so readers never see a partial
+     // file.
+    UniqueString temp = cat(
+        path, ".tmp", std::hash<std::thread::id>{}(std::this_thread::get_id())
+    );
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        raise(e_General, cat(
+            "Could not create cache file ", temp, ": ",
+            std::strerror(errno)
+        ));
+    }
+    try {
+        write_all(fd, &h, sizeof(h));
+        write_all(fd, filename.data(), filename.size());
+        usize written = sizeof(h) + filename.size();
+        for (usize i = 0; i < levels.size(); i++) {
+            auto& level = levels[i];
+            write_zeros(fd, h.level_offsets[i] - written);
+            usize row_bytes = usize(level.size.x) * bpp;
+            for (i32 y = 0; y < level.size.y; y++) {
+                write_all(fd, level.pixels + usize(y) * level.stride, row_bytes);
+            }
+            written = h.level_offsets[i] + row_bytes * level.size.y;
+        }
+    }
+    catch (...) {
+        close(fd);
+        unlink(temp.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        raise(e_General, cat(
+            "Could not rename cache file ", temp, ": ",
+            std::strerror(errno)
+        ));
+    }
+}
+
+void write_cached_pyramid (
+    const UniqueString& folder, const UniqueString& filename,
+    const DecodedImage& full
+) {
+    FileKey key;
+    if (!get_file_key(filename, key)) {
+        raise(e_General, cat("Could not stat ", filename));
+    }
+    write_cache_file(
+        folder, get_pyramid_path(folder, filename, key), filename, key,
+        full, max_levels
+    );
+}
+
+void write_cached_page (
+    const UniqueString& folder, const UniqueString& filename,
+    const DecodedImage& full
+) {
+    FileKey key;
+    if (!get_file_key(filename, key)) {
+        raise(e_General, cat("Could not stat ", filename));
+    }
+    write_cache_file(
+        folder, get_page_path(folder, key), filename, key, full, 1
+    );
+}
+
+static void collect_garbage (
+    const UniqueString& folder, const char* extension, i64 limit
+) {
+    struct Entry {
+        fs::file_time_type used_at;
+        i64 size;
+        fs::path path;
+    };
+    UniqueArray<Entry> entries;
+    i64 total = 0;
+    std::error_code code;
+    for (auto& e : fs::directory_iterator(folder.c_str(), code)) {
+        if (e.path().extension() != extension) continue;
+        std::error_code c;
+        i64 size = e.file_size(c);
+        if (c) continue;
+        auto used_at = e.last_write_time(c);
+        if (c) continue;
+        entries.emplace_back(used_at, size, e.path());
+        total += size;
+    }
+    if (total <= limit) return;
+    std::sort(&entries[0], &entries[0] + entries.size(),
+        [](const Entry& a, const Entry& b){ return a.used_at < b.used_at; }
+    );
+    for (auto& e : entries) {
+        if (total <= limit) break;
+         // Someone else may have already deleted it.  If it's mmapped, the
+         // data will stick around until it's unmapped.
+        if (fs::remove(e.path, code)) total -= e.size;
+    }
+}
+
+void collect_pyramid_garbage (const UniqueString& folder, i64 limit) {
+    collect_garbage(folder, ".pyr", limit);
+}
+
+void collect_page_cache_garbage (const UniqueString& folder, i64 limit) {
+    collect_garbage(folder, ".px", limit);
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/iri/path.h"
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/disk-cache", []{
+    using namespace tap;
+
+    UniqueString folder = ayu::resource_filename(
+        IRI("data:/test-pyramids/")
+    );
+    std::error_code code;
+    fs::remove_all(folder.c_str(), code);
+
+    auto filename = iri::to_fs_path(
+        IRI("res/liv/test/image.png", iri::program_location())
+    );
+    ok(!read_cached_pyramid(folder, filename, {GINF, GINF}),
+        "read_cached_pyramid misses before writing"
+    );
+
+    DecodedImage full = decode_image(filename);
+    doesnt_throw([&]{
+        write_cached_pyramid(folder, filename, full);
+    }, "write_cached_pyramid");
+
+    DecodedImage got = read_cached_pyramid(folder, filename, {GINF, GINF});
+    ok(!!got, "read_cached_pyramid hits after writing");
+    is(got.size, full.size, "Cached image has correct size");
+    is(got.format, full.format, "Cached image has correct format");
+    bool same = true;
+    usize row_bytes = usize(full.size.x) * bytes_per_pixel(full.format);
+    for (i32 y = 0; y < full.size.y; y++) {
+        if (std::memcmp(
+            got.pixels + y * got.stride, full.pixels + y * full.stride,
+            row_bytes
+        ) != 0) same = false;
+    }
+    ok(same, "Cached image has correct pixels");
+
+    DecodedImage small = read_cached_pyramid(folder, filename, {4, 4});
+    is(small.size, IVec(7, 5),
+        "read_cached_pyramid doesn't downscale past the smallest level"
+    );
+    is(small.original_size, IVec(7, 5), "Cached small image has original size");
+
+     // Pretend the file is big enough to have a few levels.
+    auto big_pixels = std::make_shared<UniqueArray<u8>>(1024 * 768, [](usize i){
+        return u8(i);
+    });
+    DecodedImage big;
+    big.size = big.original_size = IVec(1024, 768);
+    big.format = PixelFormat::Gray8;
+    big.stride = 1024;
+    big.pixels = big_pixels->data();
+    big.storage = big_pixels;
+    doesnt_throw([&]{
+        write_cached_pyramid(folder, filename, big);
+    }, "write_cached_pyramid with levels");
+    DecodedImage level = read_cached_pyramid(folder, filename, {300, 300});
+    is(level.size, IVec(512, 384),
+        "read_cached_pyramid picks the smallest level that fits"
+    );
+    is(level.original_size, IVec(1024, 768), "Level has original size");
+    write_cached_pyramid(folder, filename, full);
+
+    collect_pyramid_garbage(folder, 1 << 30);
+    ok(!!read_cached_pyramid(folder, filename, {GINF, GINF}),
+        "Garbage collection under limit keeps pyramid"
+    );
+    collect_pyramid_garbage(folder, 0);
+    ok(!read_cached_pyramid(folder, filename, {GINF, GINF}),
+        "Garbage collection over limit deletes pyramid"
+    );
+
+    ok(!read_cached_page(folder, filename, {GINF, GINF}),
+        "read_cached_page misses before writing"
+    );
+    doesnt_throw([&]{
+        write_cached_page(folder, filename, full);
+    }, "write_cached_page");
+    got = read_cached_page(folder, filename, {GINF, GINF});
+    ok(!!got, "read_cached_page hits after writing");
+    is(got.size, full.size, "Cached page has correct size");
+    collect_pyramid_garbage(folder, 0);
+    ok(!!read_cached_page(folder, filename, {GINF, GINF}),
+        "Pyramid garbage collection doesn't touch pages"
+    );
+    collect_page_cache_garbage(folder, 0);
+    ok(!read_cached_page(folder, filename, {GINF, GINF}),
+        "Page cache garbage collection deletes page"
+    );
+
+    fs::remove_all(folder.c_str(), code);
+    done_testing();
+});
+#endif
@@ -0,0 +1,59 @@
+ // Keeps decoded pixels on disk, so reopening images doesn't have to decode
+ // them again.  Pixels are stored uncompressed so they can be mmapped straight
+ // into the upload path.
+ //
+ // Huge images are stored as a pyramid of successively halved levels, so any
+ // level can be used and only the parts that are actually drawn get read from
+ // disk.  Other pages (if enabled) are stored at full size only.
+
+#pragma once
+
+#include "../dirt/geo/vec.h"
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+#include "page-loader.h"
+
+namespace liv {
+
+constexpr IRI pyramid_cache_folder = "data:/pyramids/";
+ // Next to marks_folder
+constexpr IRI page_cache_folder = "data:/pages/";
+
+ // All of these are safe to call from any thread.  folder is the filesystem
+ // path of the cache folder.
+
+ // Open the cached pyramid for an image file, if there is an up-to-date one.
+ // Returns the smallest level that's at least as large as the image scaled to
+ // fit in max_size, still mapped from the file, so it can be up to twice as
+ // large as max_size in each dimension.  The returned image's original_size
+ // is the full size of the image.  Returns an empty DecodedImage if the file
+ // isn't cached.
+DecodedImage read_cached_pyramid (
+    const UniqueString& folder, const UniqueString& filename, Vec max_size
+);
+
+ // Build a pyramid from a full-size decoded image and save it.  Throws on
+ // failure.
+void write_cached_pyramid (
+    const UniqueString& folder, const UniqueString& filename,
+    const DecodedImage& full
+);
+
+ // Delete least-recently-used pyramids until the folder takes up no more than
+ // limit bytes.
+void collect_pyramid_garbage (const UniqueString& folder, i64 limit);
+
+ // Like the above, but for whole pages, which are keyed by file identity
+ // (device, inode, size, and mtime) instead of path.
+DecodedImage read_cached_page (
+    const UniqueString& folder, const UniqueString& filename, Vec max_size
+);
+void write_cached_page (
+    const UniqueString& folder, const UniqueString& filename,
+    const DecodedImage& full
+);
+void collect_page_cache_garbage (const UniqueString& folder, i64 limit);
+
+} // namespace liv
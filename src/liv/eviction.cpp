@@ -0,0 +1,223 @@
+#include "eviction.h"
+
+#include <algorithm>
+#include "../dirt/geo/scalar.h"
+#include "page.h"
+
+namespace liv {
+
+void EvictionIndex::add (Page* page, double cost, isize bytes) {
+    remove(page);
+    Entry e;
+    e.index = page->index;
+    e.viewed_at = page->last_viewed_at;
+    e.cost = cost;
+    e.density = cost / max<isize>(bytes, 1);
+    e.value = inflation + e.density;
+    entries.emplace(page, e);
+    by_index.emplace(e.index, page);
+    by_viewed_at.emplace(e.viewed_at, page);
+    by_value.emplace(e.value, page);
+}
+
+void EvictionIndex::resize (Page* page, isize bytes) {
+    auto iter = entries.find(page);
+    if (iter == entries.end()) return;
+    auto& e = iter->second;
+    double density = e.cost / max<isize>(bytes, 1);
+    if (density == e.density) return;
+     // Keep whatever inflation it was added or touched with.
+    by_value.erase({e.value, page});
+    e.value += density - e.density;
+    e.density = density;
+    by_value.emplace(e.value, page);
+}
+
+void EvictionIndex::remove (Page* page) {
+    auto iter = entries.find(page);
+    if (iter == entries.end()) return;
+    auto& e = iter->second;
+    by_index.erase({e.index, page});
+    by_viewed_at.erase({e.viewed_at, page});
+    by_value.erase({e.value, page});
+    entries.erase(iter);
+}
+
+void EvictionIndex::touch (Page* page) {
+    auto iter = entries.find(page);
+    if (iter == entries.end()) return;
+    auto& e = iter->second;
+    if (e.viewed_at != page->last_viewed_at) {
+        by_viewed_at.erase({e.viewed_at, page});
+        e.viewed_at = page->last_viewed_at;
+        by_viewed_at.emplace(e.viewed_at, page);
+    }
+     // Viewing a page restores its value, like it was just loaded.
+    double value = inflation + e.density;
+    if (e.value != value) {
+        by_value.erase({e.value, page});
+        e.value = value;
+        by_value.emplace(e.value, page);
+    }
+}
+
+void EvictionIndex::reindex () {
+    by_index.clear();
+    for (auto& [page, e] : entries) {
+        e.index = page->index;
+        by_index.emplace(e.index, page);
+    }
+}
+
+Page* EvictionIndex::victim (
+    EvictionPolicy policy, Slice<i32> keep, i32 current, bool(* skip )(Page*)
+) const {
+    auto ok = [&](Page* page){
+        return !std::binary_search(keep.begin(), keep.end(), page->index)
+            && !(skip && skip(page));
+    };
+    switch (policy) {
+        case EvictionPolicy::LRU: {
+             // Pages in keep were probably viewed recently, so this shouldn't
+             // have to skip many.
+            for (auto& [_, page] : by_viewed_at) {
+                if (ok(page)) return page;
+            }
+            return null;
+        }
+        case EvictionPolicy::Distance: {
+             // The farthest page is at one end or the other.  Kept pages
+             // are usually near current, so this doesn't skip many.
+            Page* behind = null;
+            for (auto it = by_index.begin(); it != by_index.end(); ++it) {
+                if (it->first >= current) break;
+                if (ok(it->second)) { behind = it->second; break; }
+            }
+            Page* ahead = null;
+            for (auto it = by_index.rbegin(); it != by_index.rend(); ++it) {
+                if (it->first < current) break;
+                if (ok(it->second)) { ahead = it->second; break; }
+            }
+            if (!behind) return ahead;
+            if (!ahead) return behind;
+             // Prefer evicting pages behind, since reading usually goes
+             // forward.
+            return current - behind->index >= ahead->index - current
+                ? behind : ahead;
+        }
+        case EvictionPolicy::CostAware: {
+            for (auto& [_, page] : by_value) {
+                if (ok(page)) return page;
+            }
+            return null;
+        }
+        default: never();
+    }
+}
+
+void EvictionIndex::evicted (Page* page) {
+    auto iter = entries.find(page);
+    expect(iter != entries.end());
+    inflation = max(inflation, iter->second.value);
+    stats.evictions += 1;
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include <memory>
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/eviction", []{
+    using namespace tap;
+
+    UniqueArray<std::unique_ptr<Page>> pages (10, [](usize i){
+        auto r = std::make_unique<Page>(IRI(cat("file:/", i, ".png")));
+        r->index = i;
+        return r;
+    });
+    EvictionIndex ix;
+    for (i32 i = 0; i < 10; i++) {
+         // Pages loaded in a scrambled order, the middle ones more expensive
+        pages[i]->last_viewed_at = (i * 7) % 10;
+        double cost = i >= 3 && i < 7 ? i : 0.1;
+        ix.add(&*pages[i], cost, 1000);
+    }
+    is(ix.count(), usize(10), "Pages added");
+
+    auto indexes = [](IRange r){
+        return UniqueArray<i32>(size(r), [&](usize i){ return r.l + i32(i); });
+    };
+    auto lru = [&](IRange keep, auto... skip){
+        Page* r = ix.victim(EvictionPolicy::LRU, indexes(keep), 5, skip...);
+        return r ? r->index : -1;
+    };
+    is(lru({0, 0}), 0, "LRU picks least recently viewed page");
+    is(lru({0, 1}), 3, "LRU doesn't pick kept pages");
+    is(lru({0, 10}), -1, "LRU returns null if everything is kept");
+    is(lru({0, 1}, [](Page* p){ return p->index == 3; }), 6,
+        "LRU doesn't pick skipped pages"
+    );
+    pages[0]->last_viewed_at = 20;
+    ix.touch(&*pages[0]);
+    is(lru({0, 0}), 3, "Touching a page moves it to the back");
+
+    auto dist = [&](IRange keep, i32 current){
+        Page* r = ix.victim(EvictionPolicy::Distance, indexes(keep), current);
+        return r ? r->index : -1;
+    };
+    is(dist({4, 6}, 5), 0, "Distance picks farthest page behind");
+    is(dist({4, 6}, 2), 9, "Distance picks farthest page ahead");
+    is(dist({0, 6}, 5), 9, "Distance doesn't pick kept pages");
+    is(dist({0, 10}, 5), -1, "Distance returns null if everything is kept");
+    i32 strided [] = {0, 4, 5, 9};
+    Page* between = ix.victim(EvictionPolicy::Distance, strided, 4);
+    is(between ? between->index : -1, 8,
+        "Distance picks pages between kept pages"
+    );
+
+    auto cost = [&](IRange keep){
+        Page* r = ix.victim(EvictionPolicy::CostAware, indexes(keep), 5);
+        return r ? r->index : -1;
+    };
+    i32 cheap = cost({0, 0});
+    ok(cheap < 3 || cheap >= 7, "Cost-aware picks a cheap page");
+    Page* expensive = ix.victim(
+        EvictionPolicy::CostAware, {}, 5,
+        [](Page* p){ return p->index < 3 || p->index >= 7; }
+    );
+    is(expensive ? expensive->index : -1, 3,
+        "Cost-aware falls back to expensive pages"
+    );
+    for (i32 i : {0, 1, 2, 7, 8, 9}) {
+        ix.evicted(&*pages[i]);
+        ix.remove(&*pages[i]);
+    }
+    is(ix.stats.evictions, u64(6), "Evictions are counted");
+    ix.add(&*pages[0], 0.1, 1000);
+    ok(ix.entries.at(&*pages[0]).value > 0.1 / 1000,
+        "Evicting raises the value of new pages"
+    );
+    double before = ix.entries.at(&*pages[3]).value;
+    ix.resize(&*pages[3], 4000);
+    is(ix.entries.at(&*pages[3]).density, 3.0 / 4000,
+        "resize keeps the cost and changes the density"
+    );
+    ok(ix.entries.at(&*pages[3]).value < before,
+        "Holding more memory makes a page less valuable"
+    );
+
+     // Reverse the order
+    for (auto& p : pages) p->index = 9 - p->index;
+    ix.reindex();
+    is(dist({0, 1}, 0), 9, "reindex updates the index order");
+
+    for (auto& p : pages) ix.remove(&*p);
+    is(ix.count(), usize(0), "Pages removed");
+    ok(ix.by_index.empty() && ix.by_viewed_at.empty() && ix.by_value.empty(),
+        "Sets emptied"
+    );
+
+    done_testing();
+});
+#endif
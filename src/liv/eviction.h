@@ -0,0 +1,79 @@
+ // Keeps track of which pages are holding onto memory, sorted the ways the
+ // eviction policies want them, so choosing a page to unload doesn't have to
+ // look at every page in the book.
+
+#pragma once
+
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include "../dirt/geo/range.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "common.h"
+#include "settings.h"
+
+namespace liv {
+
+struct EvictionStats {
+     // Pages that were already loaded when they came into view
+    u64 hits = 0;
+     // Pages that had to be loaded when they came into view
+    u64 misses = 0;
+     // Pages unloaded to stay under the memory limit
+    u64 evictions = 0;
+};
+
+ // One of these per memory tier.  Pages must be removed before they're
+ // destroyed.
+struct EvictionIndex {
+    struct Entry {
+        i32 index;
+        double viewed_at;
+         // Seconds to load
+        double cost;
+         // Seconds to load per byte held
+        double density;
+        double value;
+    };
+    std::unordered_map<Page*, Entry> entries;
+    std::set<std::pair<i32, Page*>> by_index;
+    std::set<std::pair<double, Page*>> by_viewed_at;
+    std::set<std::pair<double, Page*>> by_value;
+     // For the cost-aware policy.  Raised to the value of every evicted page,
+     // so pages that haven't been viewed in a while eventually lose out to
+     // new pages, even expensive ones.
+    double inflation = 0;
+    EvictionStats stats;
+
+     // Start tracking a page, or update it if it's already tracked.  cost is
+     // how long the page took to load in seconds, and bytes is how much
+     // memory it's holding in this tier.
+    void add (Page*, double cost, isize bytes);
+     // The page is holding a different amount of memory than when it was
+     // added, but it still cost the same to load.  Does nothing if the page
+     // isn't tracked.
+    void resize (Page*, isize bytes);
+    void remove (Page*);
+     // Call after the page has been drawn.  Does nothing if the page isn't
+     // tracked.
+    void touch (Page*);
+     // Call after the pages' indexes have changed.
+    void reindex ();
+
+    bool tracking (Page* page) const { return entries.contains(page); }
+    usize count () const { return entries.size(); }
+
+     // Choose a page to evict, not including the page indexes in keep (which
+     // must be sorted) or pages that skip returns true for.  current is the
+     // index of the page being viewed.  Returns null if there's nothing to
+     // evict.
+    Page* victim (
+        EvictionPolicy, Slice<i32> keep, i32 current,
+        bool(* skip )(Page*) = null
+    ) const;
+     // Count the page as evicted.  Call before removing it.
+    void evicted (Page*);
+};
+
+} // namespace liv
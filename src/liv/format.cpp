@@ -7,6 +7,7 @@
 #include "../dirt/uni/hash.h"
 #include "../dirt/uni/utf.h"
 #include "book.h"
+#include "page-loader.h"
 
 namespace liv {
 
@@ -108,6 +109,8 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
         }
         case FormatCommand::PageCount:
             encat(s, book->block.count());
+             // Still listing pages
+            if (book->block.scanning()) encat(s, '+');
             break;
         case FormatCommand::BookIri: {
             auto&& loc = book->source.location_for_mark();
@@ -133,28 +136,44 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
             encat(s, (book->block.estimated_page_memory + 1023) / 1024, 'K');
             break;
         }
+        case FormatCommand::BookCacheStats: {
+            auto& stats = book->block.resident_pages.stats;
+            encat(s,
+                stats.hits, " hits, ", stats.misses, " misses, ",
+                stats.evictions, " evictions"
+            );
+            break;
+        }
+        case FormatCommand::BookPreloadStats: {
+            auto& stats = book->block.planner.stats;
+            encat(s,
+                "predicted ", stats.planned_hits, '/', stats.views,
+                ", fixed ", stats.static_hits, '/', stats.views
+            );
+            break;
+        }
         case FormatCommand::PageIri: {
             if (page < 0) break;
-            auto&& loc = book->block.pages[page]->location;
+            auto&& loc = book->block.location(page);
             encat(s, loc.spec());
             break;
         }
         case FormatCommand::PageAbs: {
             if (page < 0) break;
-            auto&& loc = book->block.pages[page]->location;
+            auto&& loc = book->block.location(page);
             encat(s, iri::to_fs_path(loc));
             break;
         }
         case FormatCommand::PageRelCwd: {
             if (page < 0) break;
-            auto&& loc = book->block.pages[page]->location;
+            auto&& loc = book->block.location(page);
             auto&& rel = loc.relative_to(iri::working_directory());
             encat(s, iri::decode_path(rel));
             break;
         }
         case FormatCommand::PageRelBook: {
             if (page < 0) break;
-            auto&& loc = book->block.pages[page]->location;
+            auto&& loc = book->block.location(page);
             auto&& base = book->source.base_for_page_rel_book();
             auto&& rel = loc.relative_to(base);
             encat(s, iri::decode_path(rel));
@@ -162,7 +181,7 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
         }
         case FormatCommand::PageRelBookParent: {
             if (page < 0) break;
-            auto&& loc = book->block.pages[page]->location;
+            auto&& loc = book->block.location(page);
             auto&& base = book->source.base_for_page_rel_book_parent();
             auto&& rel = loc.relative_to(base);
             encat(s, iri::decode_path(rel));
@@ -170,15 +189,12 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
         }
         case FormatCommand::PageFileSize: {
             if (page < 0) break;
-            std::error_code code;
-            auto&& loc = book->block.pages[page]->location;
-            auto size = fs::file_size(iri::to_fs_path(loc), code);
-            if (size == decltype(size)(-1)) {
-                encat(s, "(unavailable)");
-            }
-            else {
-                encat(s, (size + 1023) / 1024, "K");
-            }
+             // Don't stat() here, since this runs on every title update.
+             // The prober will get to it soon (visible pages go first).
+            auto& st = book->block.table.stats[page];
+            if (!st.known()) encat(s, "?K");
+            else if (st.failed()) encat(s, "(unavailable)");
+            else encat(s, (st.size + 1023) / 1024, "K");
             break;
         }
         case FormatCommand::PagePixelWidth: {
@@ -195,9 +211,9 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
         }
         case FormatCommand::PagePixelBits: {
             if (page < 0) break;
-            if (auto& texture = book->block.get(page)->texture) {
-                encat(s, texture->bpp());
-            }
+            auto p = book->block.get(page);
+            if (p->texture) encat(s, p->texture->bpp());
+            else if (p->probed) encat(s, p->file_bits);
             else encat(s, "(unavailable)");
             break;
         }
@@ -216,14 +232,41 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
                 double time = p->load_finished_at - p->load_started_at;
                 expect(time >= 0 && time <= 1000000);
                 encat(s, round(time * 1000) / 1000.0, 's');
+                if (p->upload_time > 0) {
+                    double mb = p->estimated_memory / (1024.0 * 1024.0);
+                    encat(s,
+                        " (upload ", round(p->upload_time * 1000) / 1000.0,
+                        "s @ ", round(mb / p->upload_time), "MB/s)"
+                    );
+                }
+            }
+            break;
+        }
+        case FormatCommand::PageCacheStatus: {
+            if (page < 0) break;
+            auto p = book->block.get(page);
+            switch (p->cache_status) {
+                case CacheStatus::None: break;
+                case CacheStatus::Hit: encat(s, "hit"); break;
+                case CacheStatus::Miss: encat(s, "miss"); break;
+                default: never();
             }
             break;
         }
+        case FormatCommand::PageTier: {
+            if (page < 0) break;
+            auto p = book->block.get(page);
+            if (p->state == PageState::Resident) encat(s, "gpu");
+            else if (p->loading()) encat(s, "loading");
+            else if (p->ram_copy) encat(s, "ram");
+            else encat(s, "none");
+            break;
+        }
         case FormatCommand::MergedPagesAbs: {
             auto visible = book->visible_range();
             if (!size(visible)) break;
             auto paths = UniqueArray<UniqueString>(size(visible), [=](auto i){
-                auto&& loc = book->block.pages[visible[i]]->location;
+                auto&& loc = book->block.location(visible[i]);
                 return iri::to_fs_path(loc);
             });
             merge_paths(s, paths);
@@ -233,7 +276,7 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
             auto visible = book->visible_range();
             if (!size(visible)) break;
             auto paths = UniqueArray<UniqueString>(size(visible), [=](auto i){
-                auto&& loc = book->block.pages[visible[i]]->location;
+                auto&& loc = book->block.location(visible[i]);
                 auto&& rel = loc.relative_to(iri::working_directory());
                 return iri::decode_path(rel);
             });
@@ -247,7 +290,7 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
             auto paths = UniqueArray<UniqueString>(
                 size(visible), [=, &base](auto i)
             {
-                auto&& loc = book->block.pages[visible[i]]->location;
+                auto&& loc = book->block.location(visible[i]);
                 auto&& rel = loc.relative_to(base);
                 return iri::decode_path(rel);
             });
@@ -261,7 +304,7 @@ void FormatToken::write (UniqueString& s, Book* book, i32 page) const {
             auto paths = UniqueArray<UniqueString>(
                 size(visible), [=, &base](auto i)
             {
-                auto&& loc = book->block.pages[visible[i]]->location;
+                auto&& loc = book->block.location(visible[i]);
                 auto&& rel = loc.relative_to(base);
                 return iri::decode_path(rel);
             });
@@ -378,6 +421,8 @@ AYU_DESCRIBE(liv::FormatCommand,
         value("book_abs", FormatCommand::BookAbs),
         value("book_rel_cwd", FormatCommand::BookRelCwd),
         value("book_est_mem", FormatCommand::BookEstMem),
+        value("book_cache_stats", FormatCommand::BookCacheStats),
+        value("book_preload_stats", FormatCommand::BookPreloadStats),
         value("page_iri", FormatCommand::PageIri),
         value("page_abs", FormatCommand::PageAbs),
         value("page_rel_cwd", FormatCommand::PageRelCwd),
@@ -389,6 +434,8 @@ AYU_DESCRIBE(liv::FormatCommand,
         value("page_pixel_bits", FormatCommand::PagePixelBits),
         value("page_est_mem", FormatCommand::PageEstMem),
         value("page_load_time", FormatCommand::PageLoadTime),
+        value("page_cache_status", FormatCommand::PageCacheStatus),
+        value("page_tier", FormatCommand::PageTier),
         value("merged_pages_abs", FormatCommand::MergedPagesAbs),
         value("merged_pages_rel_cwd", FormatCommand::MergedPagesRelCwd),
         value("merged_pages_rel_book", FormatCommand::MergedPagesRelBook),
@@ -454,6 +501,7 @@ static tap::TestSet tests ("liv/format", []{
         }
     );
     Book book (move(src), move(settings));
+    book.wait_for_loads();
 
     UniqueString got;
     fmt.write(got, &book);
@@ -14,6 +14,8 @@ enum class FormatCommand {
     BookAbs,
     BookRelCwd,
     BookEstMem,
+    BookCacheStats,
+    BookPreloadStats,
     PageIri,
     PageAbs,
     PageRelCwd,
@@ -25,6 +27,8 @@ enum class FormatCommand {
     PagePixelBits,
     PageEstMem,
     PageLoadTime,
+    PageCacheStatus,
+    PageTier,
     MergedPagesAbs,
     MergedPagesRelCwd,
     MergedPagesRelBook,
@@ -7,10 +7,8 @@
 
 namespace liv {
 
-UniqueArray<IRI> read_list (const IRI& loc) {
-    plog("reading list");
-    UniqueArray<IRI> r;
-
+template <class F>
+static void read_lines (const IRI& loc, F f) {
     UniqueString line;
     if (loc == "liv:stdin") {
          // TODO: Make string_from_file support filehandles
@@ -19,7 +17,7 @@ UniqueArray<IRI> read_list (const IRI& loc) {
             if (c == EOF) break;
             else if (c == '\n') {
                 if (line) {
-                    r.emplace_back(iri::from_fs_path(line));
+                    f(Str(line));
                     line = "";
                 }
             }
@@ -33,7 +31,7 @@ UniqueArray<IRI> read_list (const IRI& loc) {
         for (char c : string_from_file(iri::to_fs_path(loc))) {
             if (c == '\n') {
                 if (line) {
-                    r.emplace_back(iri::from_fs_path(line, loc));
+                    f(Str(line));
                     line = "";
                 }
             }
@@ -41,6 +39,71 @@ UniqueArray<IRI> read_list (const IRI& loc) {
             else line.push_back(c);
         }
     }
+}
+
+ // Only for editing lists, which needs IRIs to compare and sort entries.
+static UniqueArray<IRI> read_list (const IRI& loc) {
+    plog("reading list");
+    UniqueArray<IRI> r;
+    if (loc == "liv:stdin") {
+        read_lines(loc, [&](Str line){
+            r.emplace_back(iri::from_fs_path(line));
+        });
+    }
+    else {
+        read_lines(loc, [&](Str line){
+            r.emplace_back(iri::from_fs_path(line, loc));
+        });
+    }
+    return r;
+}
+
+ // Whether the path has empty, . or .. segments.
+static bool needs_normalizing (Str path) {
+    for (usize i = 0; i < path.size(); i++) {
+        if (path[i] != '/') continue;
+        Str rest = path.slice(i + 1, path.size());
+        if (rest.size() && rest[0] == '/') return true;
+        if (rest == "." || rest == ".."
+         || (rest.size() >= 2 && rest.slice(0, 2) == "./")
+         || (rest.size() >= 3 && rest.slice(0, 3) == "../")
+        ) return true;
+    }
+    return false;
+}
+
+UniqueString normalize_path (Str path) {
+    UniqueArray<Str> segments;
+    usize start = 1;
+    for (usize i = 1; i <= path.size(); i++) {
+        if (i < path.size() && path[i] != '/') continue;
+        Str seg = path.slice(start, i);
+        if (seg == "..") {
+            if (!segments.empty()) segments.pop_back();
+        }
+        else if (seg && seg != ".") segments.emplace_back(seg);
+        start = i + 1;
+    }
+    UniqueString r;
+    for (auto& seg : segments) encat(r, '/', seg);
+     // Keep the trailing slash on folders.
+    if (!r || path[path.size() - 1] == '/') encat(r, '/');
+    return r;
+}
+
+UniqueArray<UniqueString> read_list_paths (const IRI& loc) {
+    plog("reading list");
+    UniqueString base;
+    if (loc == "liv:stdin") base = fs::current_path().c_str();
+    else base = iri::to_fs_path(loc.chop_filename());
+    if (!base || base[base.size() - 1] != '/') encat(base, '/');
+    UniqueArray<UniqueString> r;
+    read_lines(loc, [&](Str line){
+        UniqueString path = line[0] == '/' ? UniqueString(line)
+                                           : cat(base, line);
+        if (needs_normalizing(path)) path = normalize_path(path);
+        r.emplace_back(move(path));
+    });
     return r;
 }
 
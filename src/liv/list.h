@@ -6,7 +6,14 @@
 
 namespace liv {
 
-UniqueArray<IRI> read_list (const IRI& loc);
+ // Returns absolute filesystem paths without making IRIs for them, which is
+ // most of the work for long lists.  Relative entries are relative to the
+ // list's folder (or the working directory for stdin).
+UniqueArray<UniqueString> read_list_paths (const IRI& loc);
+
+ // Resolve ., .. and doubled slashes in an absolute path without touching
+ // the filesystem, the same way IRIs do.
+UniqueString normalize_path (Str path);
 
 void write_list (const IRI& loc, Slice<IRI> entries);
 
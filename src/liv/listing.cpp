@@ -0,0 +1,314 @@
+#include "listing.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/hash.h"
+#include "../dirt/uni/io.h"
+#include "../dirt/uni/text.h"
+
+namespace liv {
+
+usize ListingIndex::count_pages () const {
+    usize r = 0;
+    for (auto& root : roots) r += root.tree ? root.tree->count_pages() : 1;
+    return r;
+}
+
+PageTable ListingIndex::unsorted_pages () const {
+    PageTable r;
+    for (auto& root : roots) {
+        if (root.tree) root.tree->add_to(r);
+        else r.add_path(root.path);
+    }
+    r.build_index();
+    return r;
+}
+
+PageTable ListingIndex::sorted_pages () const {
+    if (order.empty()) return {};
+    auto r = unsorted_pages();
+    if (r.size() != order.size()) return {};
+    r.permute(order);
+    return r;
+}
+
+u64 extensions_hash (Slice<AnyString> extensions) {
+    UniqueString all;
+    for (auto& e : extensions) encat(all, e, '\0');
+    return uni::hash64(all);
+}
+
+ ///// Serialization
+ // The file is the magic, a ListingHeader, then the roots, then the order.
+ // Strings are a u32 length followed by their bytes, and folders are their
+ // fields followed by their filenames and subfolders.  Paths are stored raw,
+ // the same as the filesystem gave them.  Everything is native-endian
+ // like the geometry index, since it never leaves this machine.
+
+static constexpr char listing_magic [8] = {'L','I','V','L','S','T','0','2'};
+
+struct ListingHeader {
+    u8 type;
+    u8 criterion;
+    u8 flags;
+    u8 reserved [5];
+    u64 extensions_hash;
+    u32 root_count;
+    u32 order_count;
+};
+
+namespace {
+
+struct Writer {
+    UniqueArray<char> buf;
+    void bytes (const void* p, usize n) {
+        for (usize i = 0; i < n; i++) buf.emplace_back(((const char*)p)[i]);
+    }
+    template <class T>
+    void pod (const T& v) { bytes(&v, sizeof(v)); }
+    void str (Str s) {
+        pod(u32(s.size()));
+        bytes(s.data(), s.size());
+    }
+};
+
+struct Reader {
+    Slice<char> buf;
+    usize pos = 0;
+    void bytes (void* p, usize n) {
+        if (n > buf.size() - pos) raise(e_General, "Listing index is truncated");
+        std::memcpy(p, buf.data() + pos, n);
+        pos += n;
+    }
+    template <class T>
+    T pod () { T r; bytes(&r, sizeof(r)); return r; }
+    UniqueString str () {
+        u32 n = pod<u32>();
+        if (n > buf.size() - pos) raise(e_General, "Listing index is truncated");
+        UniqueString r = Str(buf.data() + pos, n);
+        pos += n;
+        return r;
+    }
+};
+
+} // namespace
+
+static void write_folder (Writer& w, const ScannedFolder& folder) {
+    w.str(folder.path);
+    w.pod(folder.mtime);
+    w.pod(folder.inode);
+    w.pod(folder.device);
+    w.pod(u32(folder.names.size()));
+    for (auto& name : folder.names) w.str(name);
+    w.pod(u32(folder.subfolders.size()));
+    for (auto& [pos, sub] : folder.subfolders) {
+        w.pod(u32(pos));
+        write_folder(w, *sub);
+    }
+}
+
+static std::unique_ptr<ScannedFolder> read_folder (Reader& r) {
+    auto folder = std::make_unique<ScannedFolder>();
+    folder->path = r.str();
+    if (!folder->path || folder->path[folder->path.size() - 1] != '/') {
+        raise(e_General, "Listing index has an invalid folder path");
+    }
+    folder->mtime = r.pod<i64>();
+    folder->inode = r.pod<u64>();
+    folder->device = r.pod<u64>();
+    u32 file_count = r.pod<u32>();
+    for (u32 i = 0; i < file_count; i++) {
+        folder->names.emplace_back(r.str());
+    }
+    u32 sub_count = r.pod<u32>();
+    usize last_pos = 0;
+    for (u32 i = 0; i < sub_count; i++) {
+        u32 pos = r.pod<u32>();
+        if (pos < last_pos || pos > file_count) {
+            raise(e_General, "Listing index has an invalid subfolder position");
+        }
+        last_pos = pos;
+        folder->subfolders.emplace_back(pos, read_folder(r));
+    }
+    return folder;
+}
+
+ListingIndex read_listing_index (const UniqueString& path) {
+    ListingIndex r;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return r;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return r; }
+    auto buf = UniqueArray<char>(usize(st.st_size));
+    bool good = read(fd, buf.data(), buf.size()) == isize(buf.size());
+    close(fd);
+    if (!good || buf.size() < 8 || std::memcmp(buf.data(), listing_magic, 8)) {
+        return r;
+    }
+    try {
+        Reader rd {buf, 8};
+        auto h = rd.pod<ListingHeader>();
+        r.type = BookType(h.type);
+        r.sort = {SortCriterion(h.criterion), SortFlags(h.flags)};
+        r.extensions_hash = h.extensions_hash;
+        for (u32 i = 0; i < h.root_count; i++) {
+            ListingRoot root;
+            root.path = rd.str();
+            if (rd.pod<u8>()) root.tree = read_folder(rd);
+            r.roots.emplace_back(move(root));
+        }
+        r.order = UniqueArray<u32>(h.order_count);
+        rd.bytes(r.order.data(), h.order_count * sizeof(u32));
+         // Don't trust the order to be a permutation.
+        if (!r.order.empty()) {
+            usize total = r.count_pages();
+            auto seen = UniqueArray<bool>(total);
+            bool valid = r.order.size() == total;
+            for (usize i = 0; valid && i < r.order.size(); i++) {
+                u32 o = r.order[i];
+                if (o >= total || seen[o]) valid = false;
+                else seen[o] = true;
+            }
+            if (!valid) r.order = {};
+        }
+    }
+    catch (std::exception&) {
+        return ListingIndex();
+    }
+    return r;
+}
+
+void write_listing_index (const UniqueString& path, const ListingIndex& index) {
+    Writer w;
+    w.bytes(listing_magic, 8);
+    ListingHeader h = {};
+    h.type = u8(index.type);
+    h.criterion = u8(index.sort.criterion);
+    h.flags = u8(index.sort.flags);
+    h.extensions_hash = index.extensions_hash;
+    h.root_count = index.roots.size();
+    h.order_count = index.order.size();
+    w.pod(h);
+    for (auto& root : index.roots) {
+        w.str(root.path);
+        w.pod(u8(!!root.tree));
+        if (root.tree) write_folder(w, *root.tree);
+    }
+    w.bytes(index.order.data(), index.order.size() * sizeof(u32));
+
+    std::error_code code;
+    fs::create_directories(fs::path(path.c_str()).parent_path(), code);
+     // Write to a temporary file and rename, so readers never see a partial
+     // file.
+    UniqueString temp = cat(path, ".tmp");
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        raise(e_General, cat(
+            "Could not create listing index ", temp, ": ",
+            std::strerror(errno)
+        ));
+    }
+    bool good = write(fd, w.buf.data(), w.buf.size()) == isize(w.buf.size());
+    close(fd);
+    if (!good || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        raise(e_General, cat(
+            "Could not write listing index ", path, ": ",
+            std::strerror(errno)
+        ));
+    }
+}
+
+UniqueString listing_index_path (const BookSource& src) {
+    auto& loc = src.location_for_mark();
+    if (!loc) return "";
+    u64 hash = uni::hash64(loc.spec());
+    char hex [16];
+    for (usize i = 0; i < 16; i++) {
+        hex[i] = uni::to_hex_digit(hash >> 60);
+        hash <<= 4;
+    }
+    return ayu::resource_filename(
+        IRI(cat(Str(hex, 16), ".lst"), listings_folder)
+    );
+}
+
+} // namespace liv
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/listing", []{
+    using namespace tap;
+
+    IRI folder ("data:/test-listing/");
+    UniqueString base = ayu::resource_filename(folder);
+    std::error_code code;
+    fs::remove_all(base.c_str(), code);
+    UniqueString path = cat(base, "/index.lst");
+
+    ok(!read_listing_index(path), "Missing listing index reads as empty");
+
+    auto tree = std::make_unique<ScannedFolder>();
+    tree->path = "/books/a/";
+    tree->mtime = 1234;
+    tree->inode = 56;
+    tree->device = 7;
+    tree->names.emplace_back("1.png");
+    tree->names.emplace_back("3 %.png");
+    auto sub = std::make_unique<ScannedFolder>();
+    sub->path = "/books/a/b/";
+    sub->names.emplace_back("2.png");
+    tree->subfolders.emplace_back(1, move(sub));
+
+    ListingIndex index;
+    index.type = BookType::Folder;
+    index.sort = {SortCriterion::Natural, SortFlags::Reverse};
+    AnyString exts [] = {"png", "jpg"};
+    index.extensions_hash = extensions_hash(exts);
+    index.roots.emplace_back(UniqueString("/books/a/"), move(tree));
+    index.roots.emplace_back(UniqueString("/books/c.png"), null);
+    index.order = UniqueArray<u32>(4, [](usize i){ return u32(3 - i); });
+    doesnt_throw([&]{ write_listing_index(path, index); },
+        "write_listing_index"
+    );
+
+    auto got = read_listing_index(path);
+    ok(got, "read_listing_index");
+    ok(got.type == BookType::Folder && got.sort == index.sort
+        && got.extensions_hash == index.extensions_hash,
+        "Listing header survives round trip"
+    );
+    auto pages = got.unsorted_pages();
+    is(pages.size(), u32(4), "Folder trees survive round trip");
+    if (pages.size() == 4) {
+        is(pages.path(1), "/books/a/b/2.png",
+            "Subfolder positions survive round trip"
+        );
+        is(pages.path(2), "/books/a/3 %.png", "Raw names survive round trip");
+    }
+    ok(got.roots.size() == 2 && got.roots[0].tree
+        && got.roots[0].tree->mtime == 1234 && !got.roots[1].tree,
+        "Folder fingerprints survive round trip"
+    );
+    auto sorted = got.sorted_pages();
+    ok(sorted.size() == 4 && sorted.path(0) == "/books/c.png",
+        "Sorted order survives round trip"
+    );
+
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+        ok(write(fd, listing_magic, 8) == 8, "Truncated listing index");
+        close(fd);
+    }
+    ok(!read_listing_index(path), "Truncated listing index reads as empty");
+
+    fs::remove_all(base.c_str(), code);
+    done_testing();
+});
+#endif
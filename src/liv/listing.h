@@ -0,0 +1,59 @@
+ // Remembers how a book's folders were listed and sorted last time, so that
+ // reopening a big book only has to reread the folders that changed and merge
+ // their new pages into the old order, instead of listing and sorting
+ // everything again.
+
+#pragma once
+
+#include <memory>
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "book-source.h"
+#include "common.h"
+#include "page-table.h"
+#include "scan.h"
+#include "sort.h"
+
+namespace liv {
+
+constexpr IRI listings_folder = "data:/listings/";
+
+struct ListingRoot {
+     // Filesystem path of one of the book's locations
+    UniqueString path;
+     // Null if the location is a file.
+    std::unique_ptr<ScannedFolder> tree;
+};
+
+struct ListingIndex {
+     // If any of these are different, the listing can't be reused.
+    BookType type = {};
+    SortMethod sort = {};
+    u64 extensions_hash = 0;
+
+    UniqueArray<ListingRoot> roots;
+     // The sorted pages, as indexes into the pages of all the roots in order.
+     // Empty if the pages weren't sorted by a method that can be merged into.
+    UniqueArray<u32> order;
+
+    explicit operator bool () const { return !roots.empty(); }
+    usize count_pages () const;
+     // All the pages of all the roots, in the order they were listed.
+    PageTable unsorted_pages () const;
+     // Returns empty if there's no stored order.
+    PageTable sorted_pages () const;
+};
+
+u64 extensions_hash (Slice<AnyString> extensions);
+
+ // Returns an empty index if the file doesn't exist or is invalid.
+ListingIndex read_listing_index (const UniqueString& path);
+ // Throws on failure.
+void write_listing_index (const UniqueString& path, const ListingIndex&);
+ // Filesystem path of the listing index for a book, or empty if the book
+ // doesn't have a single location.
+UniqueString listing_index_path (const BookSource&);
+
+} // namespace liv
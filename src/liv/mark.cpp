@@ -10,6 +10,7 @@
 #include "../dirt/uni/text.h"
 #include "../dirt/uni/time.h"
 #include "book.h"
+#include "listing.h"
 
 namespace liv {
 
@@ -69,8 +70,13 @@ std::unique_ptr<Book> load_mark (const BookSource& src, Settings& settings) {
     }
      // Apply command-line setting overrides
     mark->state.settings->merge(move(settings));
-     // Find start page
-    PageBlock block (mark->source, *mark->state.settings);
+     // Find start page.  If it's still there, show it while the rest of the
+     // pages are listed in the background.
+    bool start_exists = mark->page
+        && fs::exists(iri::to_fs_path(mark->page).c_str());
+    PageBlock block = start_exists
+        ? PageBlock(mark->source, *mark->state.settings, mark->page)
+        : PageBlock(mark->source, *mark->state.settings);
     i32 index = block.find(mark->page);
     if (index >= 0) mark->state.page_offset = index;
      // Assemble the book
@@ -136,6 +142,9 @@ void delete_mark (Book& book) {
     auto& loc = book.source.location_for_mark();
     if (!loc) return;
     ayu::remove_source(get_mark_location(loc));
+     // The listing index goes with the mark.
+    std::error_code code;
+    fs::remove(listing_index_path(book.source).c_str(), code);
 }
 
 } using namespace liv;
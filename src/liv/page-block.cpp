@@ -1,28 +1,56 @@
 #include "page-block.h"
 
-#include <fcntl.h>
+#include <unordered_set>
+#include <sys/stat.h>
 #include "../dirt/geo/scalar.h"
 #include "../dirt/uni/io.h"
 #include "../dirt/uni/text.h"
+#include "../dirt/uni/time.h"
 #include "book-source.h"
 #include "book.h"
 #include "list.h"
+#include "listing.h"
+#include "page-loader.h"
+#include "page-uploader.h"
+#include "prefetch.h"
+#include "probe.h"
+#include "scan.h"
+#include "watch.h"
 #include "page.h"
 
 namespace liv {
 
+ // What listing a book's pages needs from its settings.  Copied out so the
+ // listing can run on another thread without sharing any strings.
+struct ExpandOptions {
+    UniqueArray<AnyString> extensions;
+    SortMethod sort;
+     // Empty if the book doesn't keep a listing index
+    UniqueString listing_path;
+    explicit ExpandOptions (const Settings& settings, const BookSource& src) :
+        sort(settings.get(&FilesSettings::sort)),
+        listing_path(listing_index_path(src))
+    {
+        auto& exts = settings.get(&FilesSettings::page_extensions);
+        extensions = UniqueArray<AnyString>(exts.size(), [&](usize i){
+            return AnyString(cat(exts[i]));
+        });
+    }
+};
+
 NOINLINE static
-UniqueArray<IRI> expand_neighbors (
-    const Settings& settings, const IRI& loc
+PageTable expand_neighbors (
+    const ExpandOptions& options, const IRI& loc
 ) {
     plog("expanding neighbors");
-    auto& extensions = settings.get(&FilesSettings::page_extensions);
-    IRI folder = loc.chop_filename();
-    Str self = iri::path_filename(loc.path());
+    auto& extensions = options.extensions;
+    UniqueString path = iri::to_fs_path(loc);
+    Str self = iri::path_filename(path);
 
-    UniqueArray<IRI> r;
+    PageTable r;
+    u32 folder = r.add_folder(path.slice(0, path.size() - self.size()));
 
-    for (Str child : Dir(iri::to_fs_path(folder))) {
+    for (Str child : Dir(r.folders[folder])) {
         expect(child[0]);
         if (child[0] == '.') continue;
          // Don't check extension if we explicitly requested the file.
@@ -34,58 +62,64 @@ UniqueArray<IRI> expand_neighbors (
             continue;
         }
         pick:
-        IRI neighbor = iri::from_fs_path(child, folder);
-        expect(neighbor);
-        r.emplace_back(move(neighbor));
+        r.add(folder, child);
     };
 
-    auto sort = settings.get(&FilesSettings::sort);
-    sort_iris(r.begin(), r.end(), sort);
+    sort_pages(r, options.sort);
+    r.build_index();
     return r;
 }
 
-NOINLINE static
-void expand_recursively_recurse (
-    UniqueArray<IRI>& r,
-    Slice<AnyString> extensions,
-    Dir& dir,
-    const IRI& folder
+ // Bring the previous sorted listing up to date with the current unsorted
+ // listing, by dropping pages that are gone and merging in new ones.  Much
+ // faster than sorting everything again when only a few pages changed.  Both
+ // tables must have their indexes built.
+static PageTable merge_listing (
+    const PageTable& old_sorted, const PageTable& current, SortMethod sort
 ) {
-    for (Str child : dir) {
-        expect(child);
-        if (child[0] == '.') continue;
-         // TODO: reduce string copies
-        if (Dir subdir = Dir::try_open_at(dir.fd, child)) {
-            IRI subfolder = iri::from_fs_path(cat(child, '/'), folder);
-            expect(subfolder);
-            expand_recursively_recurse(
-                r, extensions, subdir, subfolder
-            );
-        }
-        else {
-             // Ignore failure to open, delay it for when we load the page.
-            auto ext = ascii_to_lower(iri::path_extension(child));
-            for (auto& e : extensions) {
-                if (e == ext) goto pick;
-            }
-            continue;
-            pick:
-            IRI neighbor = iri::from_fs_path(child, folder);
-            expect(neighbor);
-            r.emplace_back(move(neighbor));
-        }
+    plog("merging listing");
+    PageTable kept;
+    for (u32 i = 0; i < old_sorted.size(); i++) {
+        if (current.find_row(old_sorted, i) >= 0) kept.add_row(old_sorted, i);
     }
+    PageTable added;
+    for (u32 i = 0; i < current.size(); i++) {
+        if (old_sorted.find_row(current, i) < 0) added.add_row(current, i);
+    }
+    sort_pages(added, sort);
+    return merge_sorted_pages(kept, added, sort);
 }
 
+ // Where each page of sorted is in unsorted, which has the same pages.  Pages
+ // that are in a list more than once are matched up one to one.
+static UniqueArray<u32> find_order (
+    const PageTable& unsorted, const PageTable& sorted
+) {
+    auto used = UniqueArray<bool>(unsorted.size());
+    return UniqueArray<u32>(sorted.size(), [&](usize i){
+        u32 r = 0;
+        unsorted.each_with_key(sorted.keys[i], [&](u32 j){
+            if (used[j]) return false;
+            if (!unsorted.has_path(j, sorted.folder(i), sorted.name(i))) {
+                return false;
+            }
+            used[j] = true;
+            r = j;
+            return true;
+        });
+        return r;
+    });
+}
 
 NOINLINE static
-UniqueArray<IRI> expand_recursively (
-    const Settings& settings, Slice<IRI> locs, BookType type
+PageTable expand_recursively (
+    const ExpandOptions& options, Slice<UniqueString> paths, BookType type,
+    const FoundFirst& found_first = null, const std::atomic<bool>* stop = null
 ) {
     plog("expanding recursively");
 
-    auto& extensions = settings.get(&FilesSettings::page_extensions);
-    auto sort = settings.get(&FilesSettings::sort);
+    auto& extensions = options.extensions;
+    auto sort = options.sort;
     bool sort_everything;
     switch (type) {
         case BookType::Misc: {
@@ -103,199 +137,1102 @@ UniqueArray<IRI> expand_recursively (
         default: never();
     }
 
-    UniqueArray<IRI> r;
-    for (auto& loc : locs) {
-        auto path = iri::to_fs_path(loc);
-        if (Dir dir = Dir::try_open_at(AT_FDCWD, path)) {
-            IRI folder = loc.add_slash_to_path();
-            usize old_size = r.size();
-            expand_recursively_recurse(
-                r, extensions, dir, folder
-            );
-            if (!sort_everything) {
-                sort_iris(r.begin() + old_size, r.end(), sort);
+     // Folders that haven't changed since last time are reused from the
+     // listing index, and if the sort only depends on the paths, so is the
+     // order of their pages.
+    ListingIndex old;
+    if (options.listing_path) {
+        old = read_listing_index(options.listing_path);
+        if (old.type != type || old.sort != sort
+         || old.extensions_hash != extensions_hash(extensions)
+        ) old = {};
+    }
+    bool keep_order = sort_everything && sort_is_mergeable(sort);
+     // Let the scan stat files while it's at it, if the sort will need it.
+    bool want_stats = sort.criterion == SortCriterion::LastModified
+                   || sort.criterion == SortCriterion::FileSize;
+     // Get this before scanning, which moves pages out of old.
+    PageTable old_sorted;
+    if (keep_order) old_sorted = old.sorted_pages();
+    bool changed = !old || old.roots.size() != paths.size()
+                || (keep_order && old.order.empty());
+
+    ListingIndex index;
+    index.type = type;
+    index.sort = sort;
+    index.extensions_hash = extensions_hash(extensions);
+    PageTable r;
+    for (usize i = 0; i < paths.size(); i++) {
+        Str path = paths[i];
+        bool same_root = i < old.roots.size() && old.roots[i].path == path;
+        ListingRoot root;
+        root.path = path;
+        struct stat st;
+        if (stat(root.path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            ScannedFolder* previous = null;
+            for (auto& o : old.roots) {
+                if (o.tree && o.path == path) {
+                    previous = &*o.tree;
+                    break;
+                }
             }
+            if (!same_root || !previous) changed = true;
+            bool tree_changed;
+            root.tree = scan_folder_tree(
+                path, extensions, previous, &tree_changed, 0, found_first,
+                want_stats, stop
+            );
+            if (tree_changed) changed = true;
+            u32 old_size = r.size();
+            root.tree->add_to(r);
+            if (!sort_everything) sort_pages(r, sort, old_size, r.size());
         }
         else {
+            if (!same_root || old.roots[i].tree) changed = true;
              // Don't check the file extension or hiddenness for explicitly
              // specified files.
-            r.emplace_back(loc);
+            if (found_first && !r.size()) found_first(iri::from_fs_path(path));
+            r.add_path(path);
         }
+        index.roots.emplace_back(move(root));
+    }
+    r.build_index();
+    if (!options.listing_path) {
+        if (sort_everything) sort_pages(r, sort);
+        return r;
     }
+
+     // The sorted pages as indexes into the unsorted pages
+    UniqueArray<u32> order;
     if (sort_everything) {
-        sort_iris(r.begin(), r.end(), sort);
+        if (!changed && old_sorted.size() == r.size()) {
+            plog("reusing sorted listing");
+            r = move(old_sorted);
+        }
+        else if (old_sorted.size()) {
+            auto merged = merge_listing(old_sorted, r, sort);
+            order = find_order(r, merged);
+            r = move(merged);
+        }
+        else {
+            order = page_sort_order(r, sort);
+            r.permute(order);
+        }
+    }
+    if (changed) {
+        if (keep_order) index.order = move(order);
+        try {
+            write_listing_index(options.listing_path, index);
+        }
+        catch (std::exception& e) {
+            ayu::warn_utf8(cat("Error saving listing index: ", e.what(), "\n"));
+        }
     }
     return r;
 }
 
-PageBlock::PageBlock (const BookSource& src, const Settings& settings) {
-    UniqueArray<IRI> locs;
+static PageTable list_pages (
+    const BookSource& src, const ExpandOptions& options,
+    const FoundFirst& found_first = null, const std::atomic<bool>* stop = null
+) {
     switch (src.type) {
-        case BookType::Misc: {
-            locs = expand_recursively(settings, src.locations, src.type);
-            break;
-        }
+        case BookType::Misc:
         case BookType::Folder: {
-            locs = expand_recursively(settings, src.locations, src.type);
-            break;
+            auto paths = UniqueArray<UniqueString>(
+                src.locations.size(), [&](usize i){
+                    return iri::to_fs_path(src.locations[i]);
+                }
+            );
+            return expand_recursively(
+                options, paths, src.type, found_first, stop
+            );
         }
         case BookType::List: {
-            locs = read_list(src.locations[0]);
-            locs = expand_recursively(settings, locs, src.type);
-            break;
+            auto paths = read_list_paths(src.locations[0]);
+            return expand_recursively(
+                options, paths, src.type, found_first, stop
+            );
         }
         case BookType::FileWithNeighbors: {
-            locs = expand_neighbors(settings, src.locations[0]);
-            break;
+            return expand_neighbors(options, src.locations[0]);
         }
         default: never();
     }
-    pages = decltype(pages)(locs.size(), [&](usize i){
-        return std::make_unique<Page>(locs[i]);
+}
+
+static void apply_geometry (
+    const GeometryIndex& geometry, PageTable& table, u32 i
+) {
+    if (geometry.entries.empty()) return;
+    if (auto e = geometry.find(table.keys[i])) {
+        table.sizes[i] = e->info.size;
+        table.bits[i] = e->info.bits;
+        table.flags[i] = PageFlags::Probed;
+        if (e->info.alpha) table.flags[i] |= PageFlags::Alpha;
+    }
+}
+
+ // Save what a page learned about its layout before it's dropped.
+static void store_layout (PageTable& table, u32 i, const Page& page) {
+    if (page.size != IVec()) table.sizes[i] = page.size;
+    if (page.probed) {
+        table.bits[i] = page.file_bits;
+        table.flags[i] = PageFlags::Probed;
+        if (page.file_alpha) table.flags[i] |= PageFlags::Alpha;
+    }
+}
+
+ // Whether the page has nothing that the table doesn't, so it can be dropped
+ // and made again when it's needed.  Failed pages are kept so they aren't
+ // tried again.
+static bool page_is_idle (const Page& page) {
+    return page.state == PageState::Unloaded
+        && !page.ram_copy && !page.compressing && !page.upgrading;
+}
+
+static std::unique_ptr<BackgroundScan> start_scan (
+    const BookSource& src, const Settings& settings
+) {
+     // Copy the source too, so the scan thread doesn't share its IRIs.
+     // (std::function has to be copyable, hence the shared_ptr.)
+    auto locs = UniqueArray<IRI>(src.locations.size(), [&](usize i){
+        return IRI(cat(src.locations[i].spec()));
+    });
+    auto job = std::make_shared<std::pair<BookSource, ExpandOptions>>(
+        BookSource(src.type, move(locs)), ExpandOptions(settings, src)
+    );
+    return std::make_unique<BackgroundScan>([job](
+        const FoundFirst& found, const std::atomic<bool>& stop
+    ){
+        return list_pages(job->first, job->second, found, &stop);
     });
 }
+
+PageBlock::PageBlock (const BookSource& src, const Settings& settings) {
+     // Lay out pages from last time's sizes until they're probed again.
+    geometry_path = geometry_index_path(src);
+    if (geometry_path) geometry = read_geometry_index(geometry_path);
+    replace_pages(list_pages(src, ExpandOptions(settings, src)));
+}
+
+PageBlock::PageBlock (
+    const BookSource& src, const Settings& settings, const IRI& start
+) {
+    geometry_path = geometry_index_path(src);
+    if (geometry_path) geometry = read_geometry_index(geometry_path);
+    if (start) replace_pages(PageTable(Slice<IRI>(&start, 1)));
+    scan = start_scan(src, settings);
+}
 PageBlock::~PageBlock () { }
 
 void PageBlock::resort (SortMethod method) {
-     // Make array of just IRIs for sorting
-    auto locs = UniqueArray<IRI>(pages.size(), [this](usize i){
-        return pages[i]->location;
-    });
-     // Do the sort
-    sort_iris(locs.begin(), locs.end(), method);
-     // Normally pages are indexed by offset, but we need to temporarily index
-     // them by location.
-    std::unordered_map<Str, std::unique_ptr<Page>> by_loc;
-    pages.consume([&by_loc](auto&& page) {
-        by_loc.emplace(page->location.spec(), move(page));
-    });
-     // Reorder pages, reusing existing objects
-    pages = decltype(pages)(locs.size(), [&](usize i){
-        auto iter = by_loc.find(locs[i].spec());
-        if (iter != by_loc.end()) {
-            auto r = move(iter->second);
-            by_loc.erase(iter);
-            return r;
-        }
-        else return std::make_unique<Page>(locs[i]);
-    });
+     // Sort the table's paths directly, and move the pages along with them.
+    auto order = page_sort_order(table, method);
+    table.permute(order);
+    auto old_pages = move(pages);
+    pages = decltype(pages)(table.size());
+    for (u32 i = 0; i < table.size(); i++) {
+        auto& page = old_pages[order[i]];
+        if (!page) continue;
+        if (page_is_idle(*page)) store_layout(table, i, *page);
+        else {
+            page->index = i;
+            pages[i] = move(page);
+        }
+    }
+     // Indexes have changed
+    resident_pages.reindex();
+    ram_pages.reindex();
+    if (prefetcher) prefetcher->cancel();
+    prefetched = {0, 0};
+}
+
+void PageBlock::replace_pages (PageTable new_table) {
+    PageTable old_table = move(table);
+    auto old_pages = move(pages);
+    table = move(new_table);
+    if (table.slots.empty()) table.build_index();
+    pages = decltype(pages)(table.size());
+    auto kept = UniqueArray<bool>(old_table.size());
+     // Carry over everything known about pages that are still here, looking
+     // them up by path.
+    for (u32 i = 0; i < table.size(); i++) {
+        Str folder = table.folder(i);
+        Str name = table.name(i);
+        i32 o = -1;
+        old_table.each_with_key(table.keys[i], [&](u32 j){
+            if (kept[j] || !old_table.has_path(j, folder, name)) return false;
+            o = j;
+            return true;
+        });
+        if (o < 0) {
+            apply_geometry(geometry, table, i);
+            continue;
+        }
+        kept[o] = true;
+        table.sizes[i] = old_table.sizes[o];
+        table.bits[i] = old_table.bits[o];
+        table.flags[i] = old_table.flags[o];
+        if (!table.stats[i].known()) table.stats[i] = old_table.stats[o];
+        if (auto& page = old_pages[o]) {
+            if (page_is_idle(*page)) {
+                store_layout(table, i, *page);
+                page = null;
+            }
+            else {
+                page->index = i;
+                pages[i] = move(page);
+            }
+        }
+    }
+     // Indexes have changed
+    resident_pages.reindex();
+    ram_pages.reindex();
+    if (prefetcher) prefetcher->cancel();
+    prefetched = {0, 0};
      // We need to explicitly unload any images that are left over because we're
      // keeping track of the estimated memory usage.
-    for (auto& [_, page] : by_loc) {
-        unload_page(&*page);
-        page = {};
+    for (u32 o = 0; o < old_table.size(); o++) {
+        if (kept[o]) continue;
+        if (auto& page = old_pages[o]) {
+            unload_page(&*page);
+            page = null;
+        }
+        u64 key = old_table.keys[o];
+        if (prober && table.find_key(key) < 0) prober->cancel(key);
+    }
+}
+
+bool PageBlock::finish_scan (Book* book) {
+    if (!scan) return false;
+    if (!scan->done()) {
+         // Show the first page found while we wait for the rest.
+        if (count()) return false;
+        IRI first = scan->take_first();
+        if (!first) return false;
+        replace_pages(PageTable(Slice<IRI>(&first, 1)));
+        book->view.update_spread();
+        return true;
+    }
+    PageTable result;
+    try {
+        result = scan->take_result();
+    }
+    catch (std::exception& e) {
+        ayu::warn_utf8(cat("Error listing pages: ", e.what(), "\n"));
+        scan = null;
+        book->view.update_title();
+        return true;
+    }
+    scan = null;
+     // Keep viewing the same page in its final position.
+    UniqueString current;
+    i32 offset = book->state.page_offset;
+    if (offset >= 0 && offset < count()) current = table.path(offset);
+    replace_pages(move(result));
+    if (current) {
+        i32 i = table.find_path(current);
+        if (i >= 0) book->state.page_offset = i;
+    }
+    book->state.page_offset = clamp(
+        book->state.page_offset, 0, max(count() - 1, 0)
+    );
+     // Probe again with all the pages.
+    prober = null;
+    probed_entries = {};
+    geometry_dirty = false;
+    book->view.update_spread();
+    reschedule(book);
+    return true;
+}
+
+bool PageBlock::finish_watch (Book* book) {
+    auto& settings = *book->state.settings;
+    if (book->source.type != BookType::Folder || watch_failed
+     || !settings.get(&FilesSettings::watch)
+    ) {
+        watcher = null;
+        return false;
+    }
+     // Start watching once the pages are listed.
+    if (scan) return false;
+    if (!watcher) {
+        try {
+            watcher = std::make_unique<FolderWatcher>(
+                book->source.locations,
+                settings.get(&FilesSettings::page_extensions)
+            );
+        }
+        catch (std::exception& e) {
+            ayu::warn_utf8(cat(e.what(), "\n"));
+             // Don't keep trying.
+            watch_failed = true;
+        }
+        return false;
+    }
+    auto changes = watcher->take_changes();
+    if (changes.empty()) return false;
+    if (changes.lost) {
+         // We don't know what changed, so list everything again.  The
+         // listing index makes this cheap for folders that didn't change.
+        watcher = null;
+        scan = start_scan(book->source, settings);
+        return true;
+    }
+    plog("applying folder changes");
+    std::unordered_set<u64> removed;
+    for (auto& iri : changes.removed) removed.emplace(geometry_key(iri));
+    auto removed_folders = UniqueArray<UniqueString>(
+        changes.removed_folders.size(), [&](usize i){
+            return iri::to_fs_path(changes.removed_folders[i]);
+        }
+    );
+    auto gone = [&](u32 i){
+        if (removed.contains(table.keys[i])) return true;
+        Str folder = table.folder(i);
+        for (auto& prefix : removed_folders) {
+            if (folder.size() >= prefix.size()
+             && folder.slice(0, prefix.size()) == prefix
+            ) return true;
+        }
+        return false;
+    };
+     // If the current page goes away, stay at the same position among the
+     // pages that are left.
+    i32 offset = book->state.page_offset;
+    UniqueString current;
+    if (offset >= 0 && offset < count()) current = table.path(offset);
+     // Files that were rewritten need to be stat()ed (and probed) again, and
+     // anything decoded from the old file has to go.
+    PageTable added;
+    bool rewritten = false;
+    for (auto& iri : changes.added) {
+        auto path = iri::to_fs_path(iri);
+        i32 j = table.find_path(path);
+        if (j < 0) {
+            added.add_path(path);
+            continue;
+        }
+        rewritten = true;
+        unload_page(peek(j));
+        table.stats[j] = {};
+        if (prober) {
+            GeometryEntry known;
+            known.key = table.keys[j];
+            prober->request(move(path), known, false);
+        }
+    }
+    i32 kept_before = 0;
+    PageTable kept;
+    for (u32 i = 0; i < table.size(); i++) {
+        if (gone(i)) continue;
+        if (i32(i) < offset) kept_before += 1;
+        kept.add_row(table, i);
+    }
+    if (!added.size() && kept.size() == table.size()) {
+        if (!rewritten) return false;
+         // Nothing moved, but the rewritten pages need to be loaded again.
+        book->view.update_spread();
+        reschedule(book);
+        return true;
     }
+     // Insert new pages where the book's sort would put them.  This is one
+     // merge (or at worst one sort) per batch, however many files were in it.
+    auto sort = settings.get(&FilesSettings::sort);
+    if (sort_is_mergeable(sort)) {
+        sort_pages(added, sort);
+        replace_pages(merge_sorted_pages(kept, added, sort));
+    }
+    else {
+        for (u32 i = 0; i < added.size(); i++) kept.add_row(added, i);
+         // Appending is as good as anything for shuffled or unsorted books.
+        if (sort.criterion != SortCriterion::Shuffle) sort_pages(kept, sort);
+        replace_pages(move(kept));
+    }
+    i32 i = current ? table.find_path(current) : -1;
+    book->state.page_offset = clamp(
+        i >= 0 ? i : kept_before, 0, max(count() - 1, 0)
+    );
+    if (book->state.page_offset != offset || i < 0) book->need_mark = true;
+     // Lay out the new pages too.
+    if (prober) {
+        for (u32 a = 0; a < added.size(); a++) {
+            i32 j = table.find_row(added, a);
+            if (j < 0 || table.flags[j] % PageFlags::Probed) continue;
+            GeometryEntry known;
+            known.key = table.keys[j];
+            prober->request(table.path(j), known, false);
+        }
+    }
+    book->view.update_spread();
+    reschedule(book);
+    return true;
+}
+
+void PageBlock::wait_for_scan (Book* book) {
+    if (!scan) return;
+    scan->wait();
+    finish_scan(book);
 }
 
-Page* PageBlock::get (int32 i) const {
+Page* PageBlock::get (int32 i) {
     if (i < 0 || i >= count()) return null;
-    else return &*pages[i];
+    auto& page = pages[i];
+    if (!page) {
+        page = std::make_unique<Page>(table.location(i));
+        page->index = i;
+        page->size = table.sizes[i];
+        if (table.flags[i] % PageFlags::Probed) {
+            page->file_bits = table.bits[i];
+            page->file_alpha = table.flags[i] % PageFlags::Alpha;
+            page->probed = true;
+        }
+    }
+    return &*page;
+}
+
+static void request_page (
+    PageBlock& self, Page* page, Book* book, Vec max_size, i32 priority
+) {
+    auto& settings = *book->state.settings;
+    if (!self.loader) {
+        self.loader = std::make_unique<PageLoader>(decode_thread_count(
+            settings.get(&MemorySettings::decode_threads)
+        ));
+    }
+    DecodeOptions options;
+    options.max_size = max_size;
+     // Upgrades need the full-resolution file.
+    if (page->state != PageState::Resident) {
+        options.ram_copy = page->ram_copy;
+    }
+    double ram_mb = settings.get(&MemorySettings::ram_cache_mb);
+     // A page that would take up more than a quarter of the budget isn't
+     // worth compressing.
+    options.compress_limit = ram_mb * (1024*1024) / 4;
+    double pyramid_mb = settings.get(&MemorySettings::pyramid_cache_mb);
+    i32 tile_size = page_tile_size(settings);
+     // Tiled pages get a copy about the size of the window for drawing them
+     // zoomed out, and for filling in tiles until they're uploaded.
+    Vec ps = book->view.get_picture_size();
+    float overview = min(max(ps.x, ps.y), float(tile_size));
+    options.overview_threshold = tile_size;
+    options.overview_size = Vec(overview, overview);
+     // Only images that would have to be tiled are worth caching.  Most pages
+     // have been probed by now, so don't look in the cache for the ones that
+     // are known to be small.
+    if (pyramid_mb > 0
+     && (!page->probed || needs_tiles(page->size, tile_size))
+    ) {
+        options.pyramid_threshold = tile_size;
+        options.pyramid_cache_limit = pyramid_mb * (1024*1024);
+    }
+    double disk_mb = settings.get(&MemorySettings::disk_cache_mb);
+    options.page_cache_limit = disk_mb * (1024*1024);
+    self.loader->request(
+        page, iri::to_fs_path(page->location), options, priority
+    );
 }
 
-int32 PageBlock::find (const IRI& loc) const {
-    if (!loc) return -1;
-    for (int32 i = 0; i < int32(pages.size()); i++) {
-        if (pages[i]->location == loc) return i;
+void PageBlock::load_page (Page* page, Book* book, i32 priority) {
+    if (!page) return;
+    switch (page->state) {
+        case PageState::Unloaded: break;
+         // Might need to be reprioritized.
+        case PageState::Queued: break;
+        default: return;
+    }
+    auto& settings = *book->state.settings;
+    Vec max_size = {GINF, GINF};
+    if (settings.get(&MemorySettings::residency) == Residency::Display) {
+        max_size = book->view.get_max_page_size();
+    }
+    request_page(*this, page, book, max_size, priority);
+    page->state = PageState::Queued;
+}
+
+void PageBlock::load_visible_page (Page* page, Book* book) {
+    if (!page) return;
+    if (page->state != PageState::Unloaded
+     && page->state != PageState::Queued
+    ) return;
+    IRange viewing = book->state.viewing_range();
+    for (usize i = 0; i < visible_loads.size();) {
+        Page* p = visible_loads[i];
+        if (!p->loading()) {
+            visible_loads.erase(i);
+            continue;
+        }
+        if (p != page && !contains(viewing, p->index)) {
+             // Scrolled past while still being decoded.  Its decode can't be
+             // stopped, so don't start another until it's done.
+            if (p->state == PageState::Decoding) {
+                visible_deferred = true;
+                return;
+            }
+             // Scrolled past before it was started, so it shouldn't get in
+             // front of this one.  The preloader will bring it back if it's
+             // still wanted.  This takes it out of visible_loads.
+            if (p->state == PageState::Queued) {
+                demote_page(p);
+                continue;
+            }
+        }
+        i++;
+    }
+    load_page(page, book, 0);
+    for (Page* p : visible_loads) if (p == page) return;
+    visible_loads.emplace_back(page);
+}
+
+void PageBlock::load_deferred_pages (Book* book) {
+    if (!visible_deferred) return;
+    visible_deferred = false;
+    for (i32 i : book->visible_range()) {
+        load_visible_page(get(i), book);
     }
-    return -1;
 }
 
-void PageBlock::load_page (Page* page) {
-    if (page && !page->texture) {
-        page->load();
-        estimated_page_memory += page->estimated_memory;
+void PageBlock::upgrade_page (Page* page, Book* book) {
+    if (!page || page->state != PageState::Resident) return;
+    if (!page->downscaled() || page->upgrading) return;
+    request_page(*this, page, book, {GINF, GINF}, 0);
+    page->upgrading = true;
+}
+
+void PageBlock::erase (i32 i) {
+    if (i < 0 || i >= count()) return;
+    if (Page* page = peek(i)) unload_page(page);
+    u64 key = table.keys[i];
+    table.erase(i);
+    pages.erase(i);
+    if (prober && table.find_key(key) < 0) prober->cancel(key);
+    for (i32 j = i; j < count(); j++) {
+        if (pages[j]) pages[j]->index = j;
     }
+    resident_pages.reindex();
+    ram_pages.reindex();
 }
 
 void PageBlock::unload_page (Page* page) {
-    if (page && page->texture) {
-        page->unload();
+    if (!page) return;
+    demote_page(page);
+    drop_ram_copy(page);
+}
+
+void PageBlock::drop_ram_copy (Page* page) {
+    if (page->compressing) {
+        expect(loader);
+        loader->cancel_compress(page);
+        page->compressing = false;
+    }
+    if (!page->ram_copy) return;
+    ram_pages.remove(page);
+    estimated_ram_memory -= page->ram_copy->data_size;
+    expect(estimated_ram_memory >= 0);
+    page->ram_copy = null;
+}
+
+static void forget_tiled (PageBlock& self, Page* page) {
+    for (usize i = 0; i < self.tiled_pages.size(); i++) {
+        if (self.tiled_pages[i] == page) {
+            self.tiled_pages.erase(i);
+            return;
+        }
+    }
+}
+
+void PageBlock::demote_page (Page* page) {
+    if (!page) return;
+    for (usize i = 0; i < visible_loads.size(); i++) {
+        if (visible_loads[i] == page) {
+            visible_loads.erase(i);
+            break;
+        }
+    }
+     // Resident pages may have an upgrade in flight.
+    if (page->loading() || page->upgrading) {
+        expect(loader);
+        loader->cancel(page);
+    }
+     // Or a tile being uploaded.
+    if (uploader) uploader->cancel(page);
+    if (page->state == PageState::Resident) {
+        resident_pages.remove(page);
         estimated_page_memory -= page->estimated_memory;
         expect(estimated_page_memory >= 0);
     }
+    forget_tiled(*this, page);
+    page->unload();
 }
 
-bool PageBlock::idle_processing (const Book* book, const Settings& settings) {
-    auto viewing = IRange{
-        book->state.page_offset,
-        book->state.page_offset + settings.get(&LayoutSettings::spread_count)
-    };
+void PageBlock::count_view (Page* page) {
+    if (page->state == PageState::Failed) return;
+    if (page->state == PageState::Resident) {
+        resident_pages.stats.hits += 1;
+        return;
+    }
+    resident_pages.stats.misses += 1;
+    if (page->ram_copy) ram_pages.stats.hits += 1;
+    else ram_pages.stats.misses += 1;
+}
+
+void PageBlock::memory_changed (Page* page, isize old_memory) {
+    if (page->estimated_memory == old_memory) return;
+    estimated_page_memory += page->estimated_memory - old_memory;
+    expect(estimated_page_memory >= 0);
+    resident_pages.resize(page, page->estimated_memory);
+}
+
+static void page_became_ready (Book* book, Page* page) {
+    page->load_finished_at = now();
+    if (page->state == PageState::Resident) {
+        auto& block = book->block;
+        double load_time = page->load_finished_at - page->load_started_at;
+        block.resident_pages.add(page, load_time, page->estimated_memory);
+         // An upgrade can switch between tiles and a single texture.
+        forget_tiled(block, page);
+        if (page->tiled()) block.tiled_pages.emplace_back(page);
+        double& avg = block.average_load_time;
+        avg = avg ? lerp(avg, load_time, 0.2) : load_time;
+    }
+     // Relayout if this page is being viewed
+    for (auto& view : book->view.pages) {
+        if (view.page == page) {
+            book->view.update_spread();
+            break;
+        }
+    }
+}
+
+ // Start uploading the overview or a missing on-screen tile of a tiled page
+ // that's being viewed.  These go before other pages, since they're on screen
+ // now.
+static bool start_tile_upload (PageBlock& self, Book* book) {
+    for (auto& view : book->view.pages) {
+        Page* page = view.page;
+        if (page->state != PageState::Resident || !page->tiled()) continue;
+        if (!self.uploader) self.uploader = std::make_unique<PageUploader>();
+        if (page->overview_source) {
+            self.uploader->start_overview(page);
+            return true;
+        }
+        for (auto& tile : page->tiles) {
+            if (!tile.texture && tile.last_drawn_at >= page->last_viewed_at) {
+                self.uploader->start_tile(page, &tile);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool PageBlock::finish_loads (Book* book) {
+    if (!loader) return false;
+    loader->sync_states();
+    load_deferred_pages(book);
+    if (auto done = loader->take_compressed()) {
+        Page* page = done->page;
+        expect(page->compressing);
+        page->compressing = false;
+        if (done->result) {
+            drop_ram_copy(page);
+            estimated_ram_memory += done->result->data_size;
+            page->ram_copy = move(done->result);
+            ram_pages.add(page, done->cost, page->ram_copy->data_size);
+        }
+        return true;
+    }
+    if ((!uploader || !uploader->page) && !start_tile_upload(*this, book)) {
+        auto job = loader->take_finished();
+        if (!job) return false;
+        Page* page = job->page;
+        if (job->error) {
+            if (page->upgrading) {
+                 // Keep showing the downscaled texture.  Leave upgrading set
+                 // so we don't keep trying.
+                ayu::warn_utf8(cat(
+                    "Error upgrading page ", job->filename, ": ", job->error,
+                    "\n"
+                ));
+                return true;
+            }
+            page->load_started_at = job->decode_started_at;
+            page->fail(job->error);
+             // The file might have changed or gone away, so look at it again.
+            table.stats[page->index] = {};
+            if (prober) {
+                GeometryEntry known;
+                known.key = table.keys[page->index];
+                prober->request(table.path(page->index), known, true);
+            }
+            page_became_ready(book, page);
+            return true;
+        }
+        page->load_started_at = job->decode_started_at;
+        if (!job->options.ram_copy) {
+            page->cache_status = job->cache_status;
+        }
+         // Anything that went through the disk cache can be read back from
+         // it, so don't spend time compressing it.  Otherwise compress it
+         // later, so it doesn't hold up showing the page.
+        i64 bytes = area(job->image.size)
+                  * i64(bytes_per_pixel(job->image.format));
+        if (!job->options.ram_copy
+         && job->cache_status == CacheStatus::None
+         && bytes <= job->options.compress_limit
+        ) {
+             // Shares the pixels with the upload.
+            loader->compress(
+                page, job->image,
+                job->decode_finished_at - job->decode_started_at
+            );
+            page->compressing = true;
+        }
+        i32 tile_size = page_tile_size(*book->state.settings);
+        if (needs_tiles(job->image.size, tile_size)) {
+             // Tiles are uploaded once they're drawn, and the overview once
+             // the page is viewed.
+            isize old_memory = page->state == PageState::Resident
+                ? page->estimated_memory : 0;
+            page->set_tiles(
+                move(job->image), tile_size, move(job->overview)
+            );
+            estimated_page_memory += page->estimated_memory - old_memory;
+            page_became_ready(book, page);
+            return true;
+        }
+        if (!uploader) uploader = std::make_unique<PageUploader>();
+        plog("starting page upload");
+        bool mipmaps = book->state.settings->get(
+            &RenderSettings::downscaler
+        ) == Downscaler::Mipmap;
+        uploader->start(page, move(job->image), mipmaps);
+    }
+    usize budget = book->state.settings->get(
+        &MemorySettings::upload_budget_kb
+    ) * usize(1024);
+    try {
+        uploader->step(budget);
+    }
+    catch (std::exception& e) {
+        Page* page = uploader->page;
+        bool part = uploader->tile || uploader->overview;
+        uploader->cancel(page);
+        ayu::warn_utf8(cat(
+            "Error uploading page ", table.path(page->index), ": ", e.what(),
+            "\n"
+        ));
+         // A page being upgraded keeps showing its downscaled texture.  Leave
+         // upgrading set so we don't keep trying.  A tile will be tried again
+         // the next time it's drawn.
+        if (!page->upgrading && !part) {
+            page->fail(e.what());
+            page_became_ready(book, page);
+        }
+        return true;
+    }
+    if (uploader->done()) {
+        Page* page = uploader->page;
+        isize old_memory = page->state == PageState::Resident
+            ? page->estimated_memory : 0;
+        if (uploader->tile || uploader->overview) {
+            uploader->finish();
+            memory_changed(page, old_memory);
+            book->view.update_picture();
+            return true;
+        }
+        uploader->finish();
+        estimated_page_memory += page->estimated_memory - old_memory;
+        page_became_ready(book, page);
+        plog("finished page upload");
+    }
+     // Even if the uploader is waiting on a fence, we need to be called
+     // again rather than going to sleep.  step() waited a little for the
+     // fence, so this doesn't spin.
+    return true;
+}
+
+void PageBlock::wait_for_loads (Book* book) {
+    if (!loader) return;
+    loader->wait_idle();
+    while (finish_loads(book)) { }
+}
+
+static void start_probes (
+    PageBlock& self, i32 current, const Settings& settings
+) {
+     // The prober gets its own copy of the paths, since the table can be
+     // rearranged while it's working.  It goes outward from the current
+     // page, so the pages nearby are laid out first.
+    PageTable pages;
+    for (u32 i = 0; i < self.table.size(); i++) {
+        pages.add_row(self.table, i);
+    }
+    pages.build_index();
+    self.prober = std::make_unique<Prober>(
+        decode_thread_count(settings.get(&MemorySettings::decode_threads)),
+        move(pages), current, &self.geometry
+    );
+}
+
+bool PageBlock::finish_probes (Book* book) {
+    if (!prober) return false;
+    auto done = prober->take_finished();
+    if (done.empty()) {
+        if (geometry_dirty && geometry_path && prober->idle()) {
+            geometry_dirty = false;
+            try {
+                write_geometry_index(geometry_path, move(probed_entries));
+            }
+            catch (std::exception& e) {
+                ayu::warn_utf8(cat(
+                    "Error saving geometry index: ", e.what(), "\n"
+                ));
+            }
+            probed_entries = {};
+            return true;
+        }
+        return false;
+    }
+    bool relayout = false;
+    IRange viewing = book->state.viewing_range();
+    for (auto& job : done) {
+         // The prober stat()s every page anyway, so keep what it found for
+         // sorting and the title.
+        table.each_with_key(job->known.key, [&](u32 i){
+            auto& st = table.stats[i];
+            if (st.mtime != job->stat.mtime || st.size != job->stat.size) {
+                if (contains(viewing, i32(i))) book->view.update_title();
+            }
+            st = job->stat;
+            return false;
+        });
+         // Leave it for the loader to report.
+        if (job->error) continue;
+        auto& info = job->result.info;
+        table.each_with_key(job->result.key, [&](u32 i){
+            Page* page = peek(i);
+             // The loaded texture is authoritative.
+            if (table.sizes[i] != info.size
+             && (!page || page->state != PageState::Resident)
+            ) {
+                table.sizes[i] = info.size;
+                if (page) page->size = info.size;
+                if (contains(viewing, i32(i))) relayout = true;
+            }
+            table.bits[i] = info.bits;
+            table.flags[i] = PageFlags::Probed;
+            if (info.alpha) table.flags[i] |= PageFlags::Alpha;
+            if (page) {
+                page->file_bits = info.bits;
+                page->file_alpha = info.alpha;
+                page->probed = true;
+            }
+            return false;
+        });
+        auto known = geometry.find(job->result.key);
+        if (!known || known->file_size != job->result.file_size
+         || known->file_mtime != job->result.file_mtime
+        ) geometry_dirty = true;
+        probed_entries.emplace_back(job->result);
+    }
+     // Pages that have been removed since last time also make it dirty.
+    if (probed_entries.size() == usize(count())
+     && geometry.entries.size() != probed_entries.size()
+    ) geometry_dirty = true;
+    if (relayout) book->view.update_spread();
+    return true;
+}
+
+void PageBlock::prefetch (
+    IRange viewing, IRange preload_range, const Settings& settings
+) {
+    i32 ahead = settings.get(&MemorySettings::prefetch_ahead);
+    auto want = IRange(
+        preload_range.r, max(preload_range.r, min(viewing.r + ahead, count()))
+    );
+    if (!size(want)) return;
+    if (want.l < prefetched.l || want.l > prefetched.r) {
+         // Jumped away, so the rest of the old window is probably useless.
+        if (prefetcher) prefetcher->cancel();
+        prefetched = {want.l, want.l};
+    }
+    if (want.r <= prefetched.r) return;
+    if (!prefetcher) prefetcher = std::make_unique<Prefetcher>();
+    for (i32 i = prefetched.r; i < want.r; i++) {
+        prefetcher->request(table.path(i));
+    }
+    prefetched = want;
+}
+
+static const PreloadPlan& plan_preloads (
+    PageBlock& self, Book* book, IRange viewing
+) {
+    auto& settings = *book->state.settings;
+    i64 limit = settings.get(&MemorySettings::page_cache_mb) * i64(1024*1024);
+     // Guess how many pages fit in the cache from the ones already loaded.
+    i32 budget = self.count();
+    if (usize n = self.resident_pages.count()) {
+        i64 per_page = max<i64>(self.estimated_page_memory / n, 1);
+        budget = min<i64>(limit / per_page, budget);
+    }
+    return self.planner.update(
+        book->state.reading_stats, settings,
+        viewing, self.count(), budget, self.average_load_time
+    );
+}
+
+void PageBlock::reschedule (Book* book) {
+    IRange viewing = book->state.viewing_range();
+    if (prober) {
+        for (i32 i : viewing & valid_pages()) {
+            if (!(table.flags[i] % PageFlags::Probed)
+             || !table.stats[i].known()
+            ) prober->hurry(table.keys[i]);
+        }
+    }
+    if (!loader) return;
+    auto& plan = plan_preloads(*this, book, viewing);
+     // Visible pages first, then in the plan's order.  Anything else isn't
+     // wanted anymore.
+    UniqueArray<Page*> dropped;
+    loader->reprioritize([&](Page* page) -> i32 {
+        if (contains(viewing, page->index)) return 0;
+        for (usize i = 0; i < plan.pages.size(); i++) {
+            if (plan.pages[i] == page->index) return i + 1;
+        }
+        return -1;
+    }, dropped);
+    for (Page* page : dropped) {
+        if (page->upgrading) page->upgrading = false;
+         // Also takes it out of visible_loads, since the page might be freed
+         // by the next resort.
+        else demote_page(page);
+    }
+}
+
+bool PageBlock::idle_processing (Book* book, const Settings& settings) {
+    auto viewing = book->state.viewing_range();
 
      // Unload a cached page if we're minimized
     if (book->view.window.is_minimized()) {
         switch (settings.get(&MemorySettings::trim_when_minimized)) {
             case TrimMode::None: break;
             case TrimMode::PageCache: {
-                for (int32 i = 0; i < viewing.l; ++i) {
-                    Page* page = get(i);
-                    if (page->texture) {
-                        unload_page(page);
-                        return true;
-                    }
-                }
-                for (int32 i = viewing.r; i < count(); ++i) {
-                    Page* page = get(i);
-                    if (page->texture) {
-                        unload_page(page);
-                        return true;
-                    }
-                }
-                return false;
+                UniqueArray<i32> keep;
+                for (i32 i : viewing) keep.emplace_back(i);
+                Page* page = resident_pages.victim(
+                    EvictionPolicy::Distance, keep, viewing.l
+                );
+                if (!page) return false;
+                 // Keep the compressed copy, this is about video memory.
+                demote_page(page);
+                return true;
             }
         }
     }
      // Otherwise continue as normal...
 
-    int32 preload_ahead = settings.get(&MemorySettings::preload_ahead);
-    int32 preload_behind = settings.get(&MemorySettings::preload_behind);
+    if (!prober && count()) {
+        start_probes(*this, viewing.l, settings);
+        return true;
+    }
+
     int32 page_cache_mb = settings.get(&MemorySettings::page_cache_mb);
+    int64 limit = page_cache_mb * int64(1024*1024);
 
-    auto preload_range = IRange(
-        viewing.l - preload_behind,
-        viewing.r + preload_ahead
-    ) & IRange(0, count());
+    auto& plan = plan_preloads(*this, book, viewing);
+    auto preload_range = plan.window;
 
-     // Preload pages forwards
-    for (int32 i = viewing.r; i < preload_range.r; i++) {
-        if (Page* page = get(i)) {
-            if (!page->texture && !page->load_failed) {
-                load_page(page);
-                return true;
-            }
-        }
+     // Don't preload until the viewed pages are loaded.  Besides them going
+     // first, if the reader is scrubbing through pages, this keeps us from
+     // preloading around pages that are only passed through.
+    bool viewed_loading = visible_deferred;
+    for (Page* page : visible_loads) {
+        if (page->loading()) viewed_loading = true;
     }
-     // Preload pages backwards
-    for (int32 i = viewing.l - 1; i > preload_range.l - 1; i--) {
-        if (Page* page = get(i)) {
-            if (!page->texture && !page->load_failed) {
-                load_page(page);
-                return true;
+    if (!viewed_loading) {
+         // Queue pages in order of likelihood
+        bool queued = false;
+        for (usize i = 0; i < plan.pages.size(); i++) {
+            if (Page* page = get(plan.pages[i])) {
+                if (page->state == PageState::Unloaded) {
+                    load_page(page, book, i + 1);
+                    queued = true;
+                }
             }
         }
+        if (queued) return true;
+        prefetch(viewing, preload_range, settings);
     }
-     // Unload a page if we're above the memory limit
-    int64 limit = page_cache_mb * int64(1024*1024);
+     // Unload pages if we're above the memory limit
+    auto policy = settings.get(&MemorySettings::eviction_policy);
     if (estimated_page_memory > limit) {
-        double oldest_viewed_at = GINF;
-        Page* oldest_page = null;
-        for (int32 i = 0; i < count(); i++) {
-             // Don't unload pages in the preload region, or we'll keep loading
-             // and unloading them forever.
-            if (contains(preload_range, i)) continue;
-            Page* page = get(i);
-            if (!page->texture) continue;
-            if (page->last_viewed_at < oldest_viewed_at) {
-                oldest_viewed_at = page->last_viewed_at;
-                oldest_page = page;
+         // Evict offscreen tiles of big pages first, farthest from the
+         // visible area first.
+        Page* far_page = null;
+        PageTile* far_tile = null;
+        i32 far_distance = -1;
+        for (Page* page : tiled_pages) {
+            auto& vis = page->visible_texels;
+            for (auto& tile : page->tiles) {
+                if (!tile.texture) continue;
+                 // Drawn in the latest frame
+                if (tile.last_drawn_at >= page->last_viewed_at) continue;
+                auto& in = tile.interior;
+                i32 distance = max(
+                    max(vis.l - in.r, in.l - vis.r),
+                    max(vis.b - in.t, in.b - vis.t)
+                );
+                if (distance > far_distance) {
+                    far_distance = distance;
+                    far_page = page;
+                    far_tile = &tile;
+                }
             }
         }
-        if (oldest_page) {
-            unload_page(oldest_page);
+        if (far_tile) {
+            isize old_memory = far_page->estimated_memory;
+            far_page->evict_tile(*far_tile);
+            memory_changed(far_page, old_memory);
             return true;
         }
+         // Don't unload pages in the plan, or we'll keep loading and
+         // unloading them forever.
+        bool evicted = false;
+        while (estimated_page_memory > limit) {
+            Page* victim = resident_pages.victim(
+                policy, plan.keep, viewing.l
+            );
+            if (!victim) break;
+            resident_pages.evicted(victim);
+             // Will go back to being compressed in system memory, if it's
+             // compressed.
+            demote_page(victim);
+            evicted = true;
+        }
+        if (evicted) return true;
     }
-     // Didn't do anything
-    return false;
+     // Drop compressed copies if we're above that limit too.  Prefer pages
+     // that aren't resident.
+    int64 ram_limit = settings.get(&MemorySettings::ram_cache_mb)
+                    * int64(1024*1024);
+    bool dropped = false;
+    while (estimated_ram_memory > ram_limit) {
+        Page* victim = ram_pages.victim(
+            policy, plan.keep, viewing.l,
+            [](Page* p){ return p->state == PageState::Resident; }
+        );
+        if (!victim) {
+            victim = ram_pages.victim(policy, plan.keep, viewing.l);
+        }
+        if (!victim) break;
+        ram_pages.evicted(victim);
+        drop_ram_copy(victim);
+        dropped = true;
+    }
+    return dropped;
 }
 
 } // namespace liv
@@ -320,34 +1257,34 @@ static tap::TestSet tests ("liv/page-block", []{
         iri::from_fs_path("test/", here)
     }};
     PageBlock misc_block {misc_src, *settings};
-    is(misc_block.pages.size(), 5u, "BookType::Misc");
-    is(misc_block.pages[0]->location.relative_to(here), "test/image.png", "BookType::Misc 0");
-    is(misc_block.pages[1]->location.relative_to(here), "test/image2.png", "BookType::Misc 1");
-    is(misc_block.pages[2]->location.relative_to(here), "test/non-image.txt", "BookType::Misc 2");
-    is(misc_block.pages[3]->location.relative_to(here), "test/image.png", "BookType::Misc 3");
-    is(misc_block.pages[4]->location.relative_to(here), "test/image2.png", "BookType::Misc 4");
+    is(misc_block.count(), 5, "BookType::Misc");
+    is(misc_block.location(0).relative_to(here), "test/image.png", "BookType::Misc 0");
+    is(misc_block.location(1).relative_to(here), "test/image2.png", "BookType::Misc 1");
+    is(misc_block.location(2).relative_to(here), "test/non-image.txt", "BookType::Misc 2");
+    is(misc_block.location(3).relative_to(here), "test/image.png", "BookType::Misc 3");
+    is(misc_block.location(4).relative_to(here), "test/image2.png", "BookType::Misc 4");
     ok(misc_src.location_for_mark().empty(), "BookType::Misc shouldn't be remembered");
 
     BookSource folder_src {BookType::Folder, {iri::from_fs_path("test/", here)}};
     PageBlock folder_block {folder_src, *settings};
-    is(folder_block.pages.size(), 2u, "BookType::Folder");
-    is(folder_block.pages[0]->location.relative_to(here), "test/image.png", "BookType::Folder 0");
-    is(folder_block.pages[1]->location.relative_to(here), "test/image2.png", "BookType::Folder 1");
+    is(folder_block.count(), 2, "BookType::Folder");
+    is(folder_block.location(0).relative_to(here), "test/image.png", "BookType::Folder 0");
+    is(folder_block.location(1).relative_to(here), "test/image2.png", "BookType::Folder 1");
     is(folder_src.location_for_mark().relative_to(here), "test/", "BookType::Folder name for mark");
 
     BookSource file_src {BookType::FileWithNeighbors, {iri::from_fs_path("test/image2.png", here)}};
     PageBlock file_block {file_src, *settings};
-    is(file_block.pages.size(), 2u, "BookType::FileWithNeighbors");
-    is(file_block.pages[0]->location.relative_to(here), "test/image.png", "BookType::FilewithNeighbors 0");
-    is(file_block.pages[1]->location.relative_to(here), "test/image2.png", "BookType::FilewithNeighbors 1");
+    is(file_block.count(), 2, "BookType::FileWithNeighbors");
+    is(file_block.location(0).relative_to(here), "test/image.png", "BookType::FilewithNeighbors 0");
+    is(file_block.location(1).relative_to(here), "test/image2.png", "BookType::FilewithNeighbors 1");
     ok(file_src.location_for_mark().empty(), "BookType::FileWithNeighbors shouldn't be remembered");
 
     BookSource list_src {BookType::List, {iri::from_fs_path("test/list.lst", here)}};
     PageBlock list_block {list_src, *settings};
-    is(list_block.pages.size(), 2u, "BookType::List");
+    is(list_block.count(), 2, "BookType::List");
      // Intentionally backwards
-    is(list_block.pages[0]->location.relative_to(here), "test/image2.png", "BookType::List 0");
-    is(list_block.pages[1]->location.relative_to(here), "test/image.png", "BookType::List 1");
+    is(list_block.location(0).relative_to(here), "test/image2.png", "BookType::List 0");
+    is(list_block.location(1).relative_to(here), "test/image.png", "BookType::List 1");
     is(list_src.location_for_mark().relative_to(here), "test/list.lst", "BookType::List name for mark");
 
     done_testing();
@@ -5,6 +5,10 @@
 #include "../dirt/geo/range.h"
 #include "../dirt/uni/common.h"
 #include "common.h"
+#include "eviction.h"
+#include "page-table.h"
+#include "preload.h"
+#include "probe.h"
 
 namespace liv {
 
@@ -12,31 +16,157 @@ namespace liv {
 // folders, keeping track of which pages are loaded, estimating memory usage of
 // loaded pages.
 struct PageBlock {
+     // Every page's location, and its size if that's known before loading.
+    PageTable table;
+     // Same length as table.  Pages are only made when get() asks for them,
+     // and pages that aren't holding anything are dropped again when the
+     // block is reordered.
     UniqueArray<std::unique_ptr<Page>> pages;
     i64 estimated_page_memory = 0;
+     // Total size of pages' compressed copies in system memory
+    i64 estimated_ram_memory = 0;
+     // Pages with textures, and pages with compressed copies.
+    EvictionIndex resident_pages;
+    EvictionIndex ram_pages;
+     // Resident pages that are split into tiles, whose tiles can be evicted
+     // one at a time.  There are usually only a few.
+    UniqueArray<Page*> tiled_pages;
+    PreloadPlanner planner;
+     // Pages requested by load_visible_page that may still be loading
+    UniqueArray<Page*> visible_loads;
+     // load_visible_page held off on a page
+    bool visible_deferred = false;
+     // Average seconds from requesting a page to it being ready
+    double average_load_time = 0;
+     // Created on first load request.  Declared after pages so that it's
+     // destroyed first.
+    std::unique_ptr<PageLoader> loader;
+     // Also created on demand, because it needs a GL context.
+    std::unique_ptr<PageUploader> uploader;
+    std::unique_ptr<Prefetcher> prefetcher;
+     // Lists pages in the background.  Null when it's done.
+    std::unique_ptr<BackgroundScan> scan;
+     // Watches a folder book's folders if files.watch is on.  Started after
+     // the pages are listed.
+    std::unique_ptr<FolderWatcher> watcher;
+    bool watch_failed = false;
+     // Pages that have been sent to the prefetcher since it was last
+     // cancelled.
+    IRange prefetched = {0, 0};
+     // What was saved last time the book was opened.  Empty if the book
+     // doesn't have a geometry_path.
+    GeometryIndex geometry;
+    UniqueString geometry_path;
+     // Everything probed this time, to be saved when probing is done.
+    UniqueArray<GeometryEntry> probed_entries;
+    bool geometry_dirty = false;
+     // Reads pages' image headers in the background.  Created by the first
+     // idle_processing.  It reads geometry, so it's declared after it to be
+     // destroyed first, and the block can't be moved once it's been made.
+    std::unique_ptr<Prober> prober;
 
     PageBlock () = default;
     PageBlock (PageBlock&&) = default;
     PageBlock (const PageBlock&) = delete;
+     // Lists all the pages before returning.
     PageBlock (const BookSource&, const Settings&);
+     // Lists the pages in the background.  Until that's done, the block only
+     // has start, or the first page found if start is empty.
+    PageBlock (const BookSource&, const Settings&, const IRI& start);
     ~PageBlock ();
 
     void resort (SortMethod);
+     // Replace the pages with the pages in this table, reusing the pages
+     // that are already here.  Pages that aren't holding anything are dropped
+     // rather than moved, so the spread has to be updated after this (and
+     // after resort).
+    void replace_pages (PageTable);
+     // Pick up the pages from the background listing if it's done.  Keeps
+     // the book on the same page.  Returns true if anything changed.
+    bool finish_scan (Book*);
+     // Add and remove pages that the watcher has seen change, keeping the
+     // book on the same page.  Also starts and stops the watcher according
+     // to settings.  Returns true if anything changed.
+    bool finish_watch (Book*);
+     // For testing.  Block until the background listing is done, and pick it
+     // up.
+    void wait_for_scan (Book*);
+     // The background listing isn't done, so count() isn't final.
+    bool scanning () const { return !!scan; }
 
-     // Returns null if i is out of range
-    Page* get (i32 i) const;
-     // Returns -1 if there's no page with this location
-    i32 find (const IRI&) const;
-    i32 count () const { return i32(size(pages)); }
+     // Returns null if i is out of range.  Makes the page if it doesn't exist
+     // yet.
+    Page* get (i32 i);
+     // Returns null if i is out of range or the page hasn't been made.
+    Page* peek (i32 i) const {
+        if (i < 0 || i >= count()) return null;
+        return pages[i].get();
+    }
+     // Doesn't make the page.  Requires i to be in range.
+    IRI location (i32 i) const { return table.location(i); }
+     // Returns -1 if there's no page with this location.  This is a lookup
+     // in the table's index, not a search.
+    i32 find (const IRI& loc) const { return table.find(loc); }
+    i32 count () const { return i32(table.size()); }
 
     IRange valid_pages () const { return {0, count()}; }
 
-    void load_page (Page*);
+     // Queue a page to be decoded in the background.  Pages with lower
+     // priority numbers are decoded first; visible pages are 0.  If the page
+     // is already queued, changes its priority.  Does nothing if the page is
+     // already loaded, being decoded, or failed.  If the residency setting is
+     // display, the page will be downscaled to the largest size the book's
+     // current layout can show it at.
+    void load_page (Page*, Book*, i32 priority);
+     // Like load_page, for pages being viewed.  If the reader is navigating
+     // faster than pages can be shown, waits for pages that were viewed
+     // earlier to finish decoding first, so pages that were only passed
+     // through don't pile up in the decoders.  Passed-through pages that
+     // haven't started decoding are dropped instead.
+    void load_visible_page (Page*, Book*);
+     // Retry load_visible_page for the current pages if it held off.
+    void load_deferred_pages (Book*);
+     // Replace a downscaled page with a full-resolution one, because it's
+     // being zoomed in past the downscaled size.
+    void upgrade_page (Page*, Book*);
+     // Recompute the priorities of queued pages after navigating, and drop
+     // the ones that aren't going to be preloaded anymore.
+    void reschedule (Book*);
+     // Unload the page completely.
     void unload_page (Page*);
+     // Unload and remove a page.
+    void erase (i32);
+     // Unload the page's texture, but keep its compressed copy in system
+     // memory if it has one.
+    void demote_page (Page*);
+     // Drop the compressed copy of a page.
+    void drop_ram_copy (Page*);
+     // Count a hit or miss for each tier, for a page that just came into
+     // view.
+    void count_view (Page*);
+     // Call after a resident page's estimated_memory has changed without it
+     // being reloaded (such as when its tiles are uploaded or evicted).
+    void memory_changed (Page*, isize old_memory);
+
+     // Upload part of a page that has finished decoding, up to the
+     // upload_budget_kb setting.  Returns true if any processing was done.
+     // This should happen even when not preloading.
+    bool finish_loads (Book*);
+     // For testing.  Block until all requested pages are resident.
+    void wait_for_loads (Book*);
+     // Apply the sizes of pages the prober has finished, and save the
+     // geometry index once it's done.  Returns true if any processing was
+     // done.
+    bool finish_probes (Book*);
+
+     // Send pages after the preload window to the prefetcher, up to
+     // memory.prefetch_ahead pages past the current page(s).  If the view has
+     // jumped away from the previous window, cancel it first.
+    void prefetch (IRange viewing, IRange preload_range, const Settings&);
 
      // Preload pages perhaps
      // Returns true if any processing was actually done.
-    bool idle_processing (const Book*, const Settings&);
+    bool idle_processing (Book*, const Settings&);
 };
 
 } // namespace liv
@@ -0,0 +1,573 @@
+#include "page-loader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sail/sail.h>
+#include <sail-manip/sail-manip.h>
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/io.h"
+#include "../dirt/uni/text.h"
+#include "../dirt/uni/time.h"
+#include "compress.h"
+#include "disk-cache.h"
+#include "page.h"
+
+namespace liv {
+
+DecodedImage downscale_image (const DecodedImage& img, IVec size) {
+    expect(size.x > 0 && size.y > 0);
+    expect(size.x <= img.size.x && size.y <= img.size.y);
+    u32 bpp = bytes_per_pixel(img.format);
+
+     // Which source pixels go into each destination pixel, and how much of
+     // each.  Weights for each destination pixel add up to 1.
+    struct Taps {
+        UniqueArray<i32> starts;
+        UniqueArray<i32> ends;
+        UniqueArray<float> weights; // Packed end to end
+    };
+    auto make_taps = [](i32 from, i32 to){
+        Taps r;
+        r.starts.reserve(to);
+        r.ends.reserve(to);
+        double scale = double(from) / to;
+        for (i32 i = 0; i < to; i++) {
+            double lo = i * scale;
+            double hi = (i + 1) * scale;
+            i32 start = i32(lo);
+            i32 end = min(i32(std::ceil(hi)), from);
+            r.starts.emplace_back_expect_capacity(start);
+            r.ends.emplace_back_expect_capacity(end);
+            for (i32 s = start; s < end; s++) {
+                double w = min(hi, double(s + 1)) - max(lo, double(s));
+                r.weights.emplace_back(float(w / scale));
+            }
+        }
+        return r;
+    };
+    Taps htaps = make_taps(img.size.x, size.x);
+    Taps vtaps = make_taps(img.size.y, size.y);
+
+    usize row_floats = usize(size.x) * bpp;
+    UniqueArray<float> hrow (row_floats);
+    UniqueArray<float> acc (row_floats);
+    u32 stride = size.x * bpp;
+    u8* out = new u8 [usize(stride) * size.y];
+
+    usize vw = 0;
+    for (i32 y = 0; y < size.y; y++) {
+        for (auto& a : acc) a = 0;
+        for (i32 sy = vtaps.starts[y]; sy < vtaps.ends[y]; sy++) {
+            float vweight = vtaps.weights[vw++];
+             // Shrink this source row horizontally, then add it in.
+            const u8* src = img.pixels + usize(sy) * img.stride;
+            usize hw = 0;
+            for (i32 x = 0; x < size.x; x++) {
+                float* dest = &hrow[usize(x) * bpp];
+                for (u32 c = 0; c < bpp; c++) dest[c] = 0;
+                for (i32 sx = htaps.starts[x]; sx < htaps.ends[x]; sx++) {
+                    float hweight = htaps.weights[hw++];
+                    const u8* p = src + usize(sx) * bpp;
+                    for (u32 c = 0; c < bpp; c++) dest[c] += p[c] * hweight;
+                }
+            }
+            for (usize i = 0; i < row_floats; i++) {
+                acc[i] += hrow[i] * vweight;
+            }
+        }
+        u8* dest = out + usize(y) * stride;
+        for (usize i = 0; i < row_floats; i++) {
+            dest[i] = u8(clamp(acc[i] + 0.5f, 0.f, 255.f));
+        }
+    }
+
+    DecodedImage r;
+    r.size = size;
+    r.original_size = img.original_size;
+    r.format = img.format;
+    r.stride = stride;
+    r.pixels = out;
+    r.storage = std::shared_ptr<const void>(out, [](const void* p){
+        delete[] (const u8*)p;
+    });
+    return r;
+}
+
+DecodedImage fit_image (DecodedImage img, Vec max_size) {
+    float scale = min(max_size.x / img.size.x, max_size.y / img.size.y);
+    if (scale < 1) {
+        IVec size = IVec(
+            max(i32(1), i32(std::round(img.size.x * scale))),
+            max(i32(1), i32(std::round(img.size.y * scale)))
+        );
+        if (size != img.size) return downscale_image(img, size);
+    }
+    return img;
+}
+
+DecodedImage decode_image (const UniqueString& filename, Vec max_size) {
+    sail_image* image = null;
+    auto status = sail_load_from_file(filename.c_str(), &image);
+    if (status != SAIL_OK) {
+        raise(e_General, cat("Could not decode image (SAIL status ", i32(status), ')'));
+    }
+    PixelFormat format;
+    switch (image->pixel_format) {
+        case SAIL_PIXEL_FORMAT_BPP8_GRAYSCALE:
+            format = PixelFormat::Gray8; break;
+        case SAIL_PIXEL_FORMAT_BPP16_GRAYSCALE_ALPHA:
+            format = PixelFormat::GrayAlpha8; break;
+        case SAIL_PIXEL_FORMAT_BPP24_RGB:
+            format = PixelFormat::RGB8; break;
+        case SAIL_PIXEL_FORMAT_BPP32_RGBA:
+            format = PixelFormat::RGBA8; break;
+        default: {
+             // Palettes, BGR, 16-bit channels, etc.
+            sail_image* converted = null;
+            status = sail_convert_image(
+                image, SAIL_PIXEL_FORMAT_BPP32_RGBA, &converted
+            );
+            sail_destroy_image(image);
+            if (status != SAIL_OK) {
+                raise(e_General, cat("Could not convert image pixel format (SAIL status ", i32(status), ')'));
+            }
+            image = converted;
+            format = PixelFormat::RGBA8;
+            break;
+        }
+    }
+    DecodedImage r;
+    r.size = IVec(image->width, image->height);
+    r.original_size = r.size;
+    r.format = format;
+    r.stride = image->bytes_per_line;
+    r.pixels = (const u8*)image->pixels;
+    r.storage = std::shared_ptr<const void>(image, [](const void* p){
+        sail_destroy_image((sail_image*)p);
+    });
+     // SAIL doesn't give us reduced-size decoding, so shrink it here, while
+     // we're still off the main thread.  The full-size image is freed when r
+     // is replaced.
+    return fit_image(move(r), max_size);
+}
+
+static DecodedImage load_job_image (PageLoader& self, LoadJob& job) {
+    auto& opts = job.options;
+    if (!opts.pyramid_threshold && !opts.page_cache_limit) {
+        return decode_image(job.filename, opts.max_size);
+    }
+    if (opts.pyramid_threshold) {
+        if (auto r = read_cached_pyramid(
+            self.pyramid_folder, job.filename, opts.max_size
+        )) {
+            job.cache_status = CacheStatus::Hit;
+            return r;
+        }
+    }
+    if (opts.page_cache_limit) {
+        if (auto r = read_cached_page(
+            self.page_folder, job.filename, opts.max_size
+        )) {
+            job.cache_status = CacheStatus::Hit;
+            return r;
+        }
+    }
+    DecodedImage full = decode_image(job.filename);
+    if (opts.pyramid_threshold && (
+        full.size.x > opts.pyramid_threshold ||
+        full.size.y > opts.pyramid_threshold
+    )) {
+        try {
+            write_cached_pyramid(self.pyramid_folder, job.filename, full);
+            collect_pyramid_garbage(
+                self.pyramid_folder, opts.pyramid_cache_limit
+            );
+             // Prefer the mmapped copy, so the decoded pixels can be freed
+             // and only the parts that are drawn take up memory.
+            if (auto r = read_cached_pyramid(
+                self.pyramid_folder, job.filename, opts.max_size
+            )) {
+                job.cache_status = CacheStatus::Miss;
+                return r;
+            }
+        }
+        catch (std::exception& e) {
+            uni::warn_utf8(cat(
+                "Could not cache pyramid for ", job.filename, ": ", e.what(),
+                "\n"
+            ));
+        }
+    }
+    else if (opts.page_cache_limit) {
+        try {
+            write_cached_page(self.page_folder, job.filename, full);
+            collect_page_cache_garbage(
+                self.page_folder, opts.page_cache_limit
+            );
+            job.cache_status = CacheStatus::Miss;
+        }
+        catch (std::exception& e) {
+            uni::warn_utf8(cat(
+                "Could not cache page ", job.filename, ": ", e.what(), "\n"
+            ));
+        }
+    }
+    return fit_image(move(full), opts.max_size);
+}
+
+ // Shrinking a level of the cached pyramid is much less work than shrinking the
+ // whole image.
+static DecodedImage make_overview (PageLoader& self, const LoadJob& job) {
+    auto& opts = job.options;
+    if (opts.pyramid_threshold) {
+        if (auto level = read_cached_pyramid(
+            self.pyramid_folder, job.filename, opts.overview_size
+        )) return fit_image(move(level), opts.overview_size);
+    }
+    return fit_image(job.image, opts.overview_size);
+}
+
+ // For the heap.  True if a should be decoded after b.
+static bool decode_later (const LoadJob* a, const LoadJob* b) {
+    if (a->priority != b->priority) return a->priority > b->priority;
+    return a->sequence > b->sequence;
+}
+
+static void compress_next (
+    PageLoader& self, std::unique_lock<std::mutex>& lock
+) {
+    CompressJob* job = null;
+    for (auto& j : self.compress_jobs) {
+        if (!j->started) { job = &*j; break; }
+    }
+    expect(job);
+    job->started = true;
+    self.compress_queued -= 1;
+    lock.unlock();
+    std::shared_ptr<const CompressedImage> result;
+    try {
+        result = std::make_shared<CompressedImage>(compress_image(job->image));
+    }
+    catch (std::exception& e) {
+        uni::warn_utf8(cat("Could not compress page: ", e.what(), "\n"));
+    }
+    lock.lock();
+    job->result = move(result);
+    job->image = {};
+    job->done = true;
+    self.idle_cond.notify_all();
+    wake_main_loop();
+}
+
+static void decode_thread (PageLoader& self) {
+    std::unique_lock lock (self.mutex);
+    for (;;) {
+        self.work_cond.wait(lock, [&self]{
+            return self.stopping || !self.queue.empty()
+                || self.compress_queued;
+        });
+        if (self.stopping) return;
+         // Decoding always goes first.
+        if (self.queue.empty()) {
+            compress_next(self, lock);
+            continue;
+        }
+        std::pop_heap(self.queue.begin(), self.queue.end(), decode_later);
+        LoadJob* job = self.queue.back();
+        self.queue.pop_back();
+        job->state = LoadJobState::Decoding;
+        self.decoding += 1;
+        lock.unlock();
+
+        job->decode_started_at = uni::now();
+        try {
+            auto& opts = job->options;
+            if (opts.ram_copy) {
+                job->image = decompress_image(*opts.ram_copy);
+            }
+            else job->image = load_job_image(self, *job);
+            if (opts.overview_threshold
+             && needs_tiles(job->image.size, opts.overview_threshold)
+            ) job->overview = make_overview(self, *job);
+        }
+        catch (std::exception& e) {
+            job->error = cat(e.what());
+        }
+        job->decode_finished_at = uni::now();
+
+        lock.lock();
+        job->state = LoadJobState::Decoded;
+        self.decoding -= 1;
+        self.idle_cond.notify_all();
+        wake_main_loop();
+    }
+}
+
+PageLoader::PageLoader (u32 thread_count) :
+    pyramid_folder(ayu::resource_filename(pyramid_cache_folder)),
+    page_folder(ayu::resource_filename(page_cache_folder))
+{
+    require(thread_count > 0);
+    threads.reserve(thread_count);
+    for (u32 i = 0; i < thread_count; i++) {
+        threads.emplace_back_expect_capacity([this]{ decode_thread(*this); });
+    }
+}
+
+PageLoader::~PageLoader () {
+    {
+        std::lock_guard lock (mutex);
+        stopping = true;
+    }
+    work_cond.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void PageLoader::request (
+    Page* page, UniqueString filename, const DecodeOptions& options,
+    i32 priority
+) {
+    std::lock_guard lock (mutex);
+    for (auto& job : jobs) {
+        if (job->page == page && !job->cancelled) {
+            if (job->state == LoadJobState::Queued
+             && job->priority != priority
+            ) {
+                job->priority = priority;
+                std::make_heap(queue.begin(), queue.end(), decode_later);
+            }
+            return;
+        }
+    }
+    auto job = std::make_unique<LoadJob>(page, move(filename), options);
+    job->upgrade = page->state == PageState::Resident;
+    job->priority = priority;
+    job->sequence = next_sequence++;
+    queue.push_back(&*job);
+    std::push_heap(queue.begin(), queue.end(), decode_later);
+    jobs.emplace_back(move(job));
+    work_cond.notify_one();
+}
+
+void PageLoader::rebuild_queue () {
+    queue.clear();
+    for (auto& job : jobs) {
+        if (job->state == LoadJobState::Queued && !job->cancelled) {
+            queue.push_back(&*job);
+        }
+    }
+    std::make_heap(queue.begin(), queue.end(), decode_later);
+}
+
+static void cancel_compress_locked (PageLoader& self, Page* page) {
+    for (usize i = 0; i < self.compress_jobs.size(); i++) {
+        auto& job = self.compress_jobs[i];
+        if (job->page != page || job->cancelled) continue;
+        if (!job->started) {
+            self.compress_jobs.erase(i);
+            self.compress_queued -= 1;
+        }
+         // Can't interrupt the compressor, so just forget about it when it's
+         // done.
+        else job->cancelled = true;
+        return;
+    }
+}
+
+void PageLoader::cancel (Page* page) {
+    std::lock_guard lock (mutex);
+    for (usize i = 0; i < jobs.size(); i++) {
+        auto& job = jobs[i];
+        if (job->page != page || job->cancelled) continue;
+        switch (job->state) {
+            case LoadJobState::Queued: {
+                jobs.erase(i);
+                rebuild_queue();
+                return;
+            }
+            case LoadJobState::Decoding: {
+                 // Can't interrupt the decoder, so just forget about it when
+                 // it's done.
+                job->cancelled = true;
+                return;
+            }
+            case LoadJobState::Decoded: {
+                jobs.erase(i);
+                return;
+            }
+            default: never();
+        }
+    }
+}
+
+void PageLoader::sync_states () {
+    std::lock_guard lock (mutex);
+    for (auto& job : jobs) {
+        if (job->cancelled || job->upgrade) continue;
+        switch (job->state) {
+            case LoadJobState::Queued:
+                job->page->state = PageState::Queued; break;
+            case LoadJobState::Decoding:
+                job->page->state = PageState::Decoding; break;
+            case LoadJobState::Decoded:
+                job->page->state = PageState::Decoded; break;
+            default: never();
+        }
+    }
+}
+
+std::unique_ptr<LoadJob> PageLoader::take_finished () {
+    std::lock_guard lock (mutex);
+    for (usize i = 0; i < jobs.size(); i++) {
+        if (jobs[i]->state != LoadJobState::Decoded) continue;
+        auto r = move(jobs[i]);
+        jobs.erase(i);
+        if (r->cancelled) {
+             // Nobody wants this, drop it and keep looking.
+            r = null;
+            i--;
+            continue;
+        }
+        return r;
+    }
+    return null;
+}
+
+void PageLoader::compress (Page* page, DecodedImage image, double cost) {
+    std::lock_guard lock (mutex);
+    cancel_compress_locked(*this, page);
+    auto job = std::make_unique<CompressJob>();
+    job->page = page;
+    job->image = move(image);
+    job->cost = cost;
+    compress_jobs.emplace_back(move(job));
+    compress_queued += 1;
+    work_cond.notify_one();
+}
+
+void PageLoader::cancel_compress (Page* page) {
+    std::lock_guard lock (mutex);
+    cancel_compress_locked(*this, page);
+}
+
+std::unique_ptr<CompressJob> PageLoader::take_compressed () {
+    std::lock_guard lock (mutex);
+    usize i = 0;
+    while (i < compress_jobs.size()) {
+        if (!compress_jobs[i]->done) { i++; continue; }
+        auto r = move(compress_jobs[i]);
+        compress_jobs.erase(i);
+        if (!r->cancelled) return r;
+    }
+    return null;
+}
+
+void PageLoader::wait_idle () {
+    std::unique_lock lock (mutex);
+    idle_cond.wait(lock, [this]{
+        if (!queue.empty() || decoding) return false;
+        for (auto& job : compress_jobs) {
+            if (!job->done) return false;
+        }
+        return true;
+    });
+}
+
+u32 decode_thread_count (u32 setting) {
+    if (setting) return setting;
+     // Leave a core for the main thread, and don't go overboard, because every
+     // thread can be holding a full decoded image in memory.
+    u32 cores = std::thread::hardware_concurrency();
+    return clamp(cores > 1 ? cores - 1 : 1, 1u, 4u);
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/iri/path.h"
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/page-loader", []{
+    using namespace tap;
+
+    auto filename = iri::to_fs_path(
+        IRI("res/liv/test/image.png", iri::program_location())
+    );
+    DecodedImage img = decode_image(filename);
+    is(img.size, IVec(7, 5), "decode_image gets correct size");
+    ok(img.pixels, "decode_image gets pixels");
+    ok(img.stride >= 7 * bytes_per_pixel(img.format), "decode_image stride is sane");
+    is(img.original_size, IVec(7, 5), "decode_image sets original_size");
+
+    DecodedImage small = decode_image(filename, Vec(4, 4));
+    is(small.size, IVec(4, 3), "decode_image downscales to fit max_size");
+    is(small.original_size, IVec(7, 5), "downscaled image remembers original size");
+    is(small.format, img.format, "downscaling keeps pixel format");
+
+    DecodedImage one = downscale_image(img, IVec(1, 1));
+    {
+        u32 bpp = bytes_per_pixel(img.format);
+        bool close = true;
+        for (u32 c = 0; c < bpp; c++) {
+            double sum = 0;
+            for (i32 y = 0; y < img.size.y; y++)
+            for (i32 x = 0; x < img.size.x; x++) {
+                sum += img.pixels[y * img.stride + x * bpp + c];
+            }
+            double avg = sum / area(img.size);
+            if (std::abs(one.pixels[c] - avg) > 1) close = false;
+        }
+        ok(close, "downscale_image to 1x1 averages all pixels");
+    }
+
+    throws<std::exception>([]{
+        decode_image(iri::to_fs_path(
+            IRI("res/liv/test/non-image.txt", iri::program_location())
+        ));
+    }, "decode_image throws on non-image");
+
+    Page page (IRI("res/liv/test/image.png", iri::program_location()));
+    PageLoader loader (2);
+    loader.request(&page, cat(filename), {}, 0);
+    loader.wait_idle();
+    auto job = loader.take_finished();
+    ok(!!job, "PageLoader finished a job");
+    is(job->page, &page, "Finished job has the right page");
+    is(job->image.size, IVec(7, 5), "Decoded off-thread");
+    ok(!loader.take_finished(), "No more finished jobs");
+
+    loader.compress(&page, job->image, 0);
+    loader.wait_idle();
+    auto compressed = loader.take_compressed();
+    ok(compressed && compressed->result, "Compressed off-thread");
+    if (compressed && compressed->result) {
+        is(decompress_image(*compressed->result).size, IVec(7, 5),
+            "Compressed copy decompresses to the right size"
+        );
+    }
+    loader.compress(&page, job->image, 0);
+    loader.cancel_compress(&page);
+    loader.wait_idle();
+    ok(!loader.take_compressed(), "Cancelled compress job isn't taken");
+
+    UniqueArray<std::unique_ptr<Page>> pages (3, [](usize){
+        return std::make_unique<Page>(
+            IRI("res/liv/test/image.png", iri::program_location())
+        );
+    });
+    for (i32 i = 0; i < 3; i++) {
+        loader.request(&*pages[i], cat(filename), {}, 3 - i);
+    }
+    UniqueArray<Page*> dropped;
+    loader.reprioritize([](Page*){ return -1; }, dropped);
+    loader.wait_idle();
+    usize finished = 0;
+    while (loader.take_finished()) finished++;
+    is(finished + dropped.size(), usize(3),
+        "reprioritize drops jobs that haven't started"
+    );
+
+    done_testing();
+});
+#endif
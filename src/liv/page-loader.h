@@ -0,0 +1,226 @@
+ // Decodes image files on background threads.  The main (GL) thread only has to
+ // upload the finished pixels.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "../dirt/geo/vec.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+
+namespace liv {
+
+ // The pixel layouts we upload directly.  Anything else gets converted to
+ // RGBA8 while decoding.
+enum class PixelFormat : u8 {
+    None,
+    Gray8,
+    GrayAlpha8,
+    RGB8,
+    RGBA8,
+};
+
+constexpr u32 bytes_per_pixel (PixelFormat f) {
+    switch (f) {
+        case PixelFormat::Gray8: return 1;
+        case PixelFormat::GrayAlpha8: return 2;
+        case PixelFormat::RGB8: return 3;
+        case PixelFormat::RGBA8: return 4;
+        default: return 0;
+    }
+}
+
+ // Pixels decoded from an image file, waiting to be uploaded.
+struct DecodedImage {
+    IVec size;
+     // Size of the image in the file, before any downscaling.
+    IVec original_size;
+    PixelFormat format = PixelFormat::None;
+     // Bytes between the starts of rows
+    u32 stride = 0;
+    const u8* pixels = null;
+     // Owns whatever pixels points into.
+    std::shared_ptr<const void> storage;
+
+    explicit operator bool () const { return pixels; }
+};
+
+ // Decode a whole image file.  If the image is larger than max_size in either
+ // dimension, it will be downscaled (preserving aspect ratio) to fit in it.
+ // Throws on failure.  Safe to call from any thread.
+DecodedImage decode_image (
+    const UniqueString& filename, Vec max_size = {GINF, GINF}
+);
+
+ // Area-averaging downscale.  size must not be larger than img.size.
+DecodedImage downscale_image (const DecodedImage& img, IVec size);
+ // Downscale an image if it's larger than max_size in either dimension.
+DecodedImage fit_image (DecodedImage img, Vec max_size);
+
+ // Where a page's pixels came from
+enum class CacheStatus : u8 {
+     // The disk cache wasn't used
+    None,
+     // Read from the disk cache
+    Hit,
+     // Decoded, and saved to the disk cache
+    Miss,
+};
+
+ // How to load a page
+struct DecodeOptions {
+     // Downscale to fit in this.
+    Vec max_size = {GINF, GINF};
+     // Keep images larger than this in either dimension in the pyramid cache.
+     // 0 = don't use the pyramid cache.
+    i32 pyramid_threshold = 0;
+     // Size limit of the pyramid cache in bytes
+    i64 pyramid_cache_limit = 0;
+     // Size limit of the page cache in bytes.  0 = don't use the page cache.
+    i64 page_cache_limit = 0;
+     // If the result will have to be split into tiles (because it's larger
+     // than this in either dimension), also make a copy of it that fits in
+     // overview_size, for drawing it zoomed out.  overview_size must fit in
+     // overview_threshold.  0 = don't.
+    i32 overview_threshold = 0;
+    Vec overview_size;
+     // If set, decompress this instead of reading the file.
+    std::shared_ptr<const CompressedImage> ram_copy;
+     // The caller should ask for a compressed copy of the result (with
+     // PageLoader::compress) if it takes no more than this many bytes
+     // uncompressed.  0 = don't.
+    i64 compress_limit = 0;
+};
+
+enum class LoadJobState : u8 {
+    Queued,
+    Decoding,
+    Decoded,
+};
+
+ // Compressing a decoded page for the RAM cache.  This is done after the page
+ // has been handed over, and only when nothing is waiting to be decoded, so it
+ // doesn't add to how long pages take to show up.
+struct CompressJob {
+    Page* page;
+    DecodedImage image;
+     // How long the page took to decode, for the eviction index
+    double cost = 0;
+    bool started = false;
+    bool done = false;
+    bool cancelled = false;
+    std::shared_ptr<const CompressedImage> result;
+};
+
+struct LoadJob {
+     // Only the main thread may look at the page.
+    Page* page;
+    UniqueString filename;
+    DecodeOptions options;
+     // This is a full-resolution replacement for a downscaled page that's
+     // already resident, so don't touch the page's state.
+    bool upgrade = false;
+    LoadJobState state = LoadJobState::Queued;
+     // Lower numbers are decoded first.  Jobs with the same priority are
+     // decoded in the order they were requested.
+    i32 priority = 0;
+    u64 sequence = 0;
+     // Set by the main thread if it no longer wants the result.
+    bool cancelled = false;
+    double decode_started_at = 0;
+    double decode_finished_at = 0;
+    DecodedImage image;
+     // If options.overview_threshold was set and the image is that large
+    DecodedImage overview;
+    CacheStatus cache_status = CacheStatus::None;
+     // Empty if decoding succeeded
+    UniqueString error;
+};
+
+ // A pool of decode threads.  All methods must be called from the main thread.
+struct PageLoader {
+    explicit PageLoader (u32 thread_count);
+    ~PageLoader ();
+
+     // Queue a page for decoding.  If the page is already queued, just
+     // changes its priority.
+    void request (
+        Page*, UniqueString filename, const DecodeOptions&, i32 priority
+    );
+     // Drop a page's job.  If it's already being decoded, the result will be
+     // thrown away when it's done.
+    void cancel (Page*);
+     // Recompute the priorities of queued jobs.  priority(Page*) returns the
+     // new priority, or a negative number to drop the job, in which case the
+     // page is added to dropped.  Jobs that have already started aren't
+     // affected.
+    template <class F>
+    void reprioritize (F priority, UniqueArray<Page*>& dropped);
+     // Copy job states to their pages.
+    void sync_states ();
+     // Take one finished job, or null if there aren't any.
+    std::unique_ptr<LoadJob> take_finished ();
+     // Queue a compressed copy of a decoded page, to be made when the decode
+     // threads have nothing else to do.
+    void compress (Page*, DecodedImage, double cost);
+     // Drop a page's compress job, if it has one.
+    void cancel_compress (Page*);
+     // Take one finished compress job, or null if there aren't any.  Its
+     // result is null if compression failed.
+    std::unique_ptr<CompressJob> take_compressed ();
+     // Block until there's nothing left to decode or compress.
+    void wait_idle ();
+
+     // Filesystem paths of pyramid_cache_folder and page_cache_folder
+    UniqueString pyramid_folder;
+    UniqueString page_folder;
+    std::mutex mutex;
+    std::condition_variable work_cond;
+    std::condition_variable idle_cond;
+    bool stopping = false;
+    u32 decoding = 0;
+    u64 next_sequence = 0;
+     // All jobs that haven't been taken yet (queued, decoding, and decoded).
+    UniqueArray<std::unique_ptr<LoadJob>> jobs;
+     // Queued jobs, as a heap with the next job to decode on top.
+    std::deque<LoadJob*> queue;
+     // Compress jobs that haven't been taken yet, in the order requested.
+    UniqueArray<std::unique_ptr<CompressJob>> compress_jobs;
+    u32 compress_queued = 0;
+    UniqueArray<std::thread> threads;
+
+     // Rebuild queue from jobs.  Must hold mutex.
+    void rebuild_queue ();
+};
+
+template <class F>
+void PageLoader::reprioritize (F priority, UniqueArray<Page*>& dropped) {
+    std::lock_guard lock (mutex);
+    for (usize i = 0; i < jobs.size();) {
+        auto& job = jobs[i];
+        if (job->state != LoadJobState::Queued || job->cancelled) {
+            i++; continue;
+        }
+        i32 p = priority(job->page);
+        if (p < 0) {
+            dropped.emplace_back(job->page);
+            jobs.erase(i);
+            continue;
+        }
+        job->priority = p;
+        i++;
+    }
+    rebuild_queue();
+}
+
+ // Pick a reasonable thread count if the setting is 0.
+u32 decode_thread_count (u32 setting);
+
+} // namespace liv
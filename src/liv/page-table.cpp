@@ -0,0 +1,262 @@
+#include "page-table.h"
+
+#include <bit>
+#include <sys/stat.h>
+#include "../dirt/iri/path.h"
+#include "../dirt/uni/hash.h"
+#include "../dirt/uni/text.h"
+
+namespace liv {
+
+FileStat FileStat::from (const struct ::stat& st) {
+    FileStat r;
+    r.mtime = i64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    r.size = st.st_size;
+    r.device = st.st_dev;
+    r.inode = st.st_ino;
+    return r;
+}
+
+static u64 combine_key (u64 folder_hash, Str name) {
+     // Like boost::hash_combine
+    return folder_hash ^ (
+        uni::hash64(name) + 0x9e3779b97f4a7c15
+        + (folder_hash << 6) + (folder_hash >> 2)
+    );
+}
+
+static usize split_path (Str path) {
+    for (usize i = path.size(); i > 0; i--) {
+        if (path[i-1] == '/') return i;
+    }
+    return 0;
+}
+
+u64 page_key (Str folder, Str name) {
+    return combine_key(uni::hash64(folder), name);
+}
+
+u64 page_key (Str path) {
+    usize split = split_path(path);
+    return page_key(path.slice(0, split), path.slice(split, path.size()));
+}
+
+PageTable::PageTable (Slice<IRI> locations) {
+    for (auto& loc : locations) {
+        add_path(iri::to_fs_path(loc));
+    }
+    build_index();
+}
+
+u32 PageTable::add_folder (Str path) {
+     // Pages in the same folder are usually added one after another, so check
+     // the last folder before looking it up.
+    if (!folders.empty()) {
+        Str last = folders.back();
+        if (path == last || (
+            path.size() + 1 == last.size()
+         && last.slice(0, path.size()) == path
+        )) return folders.size() - 1;
+    }
+    UniqueString folder = path;
+    if (!folder || folder[folder.size() - 1] != '/') encat(folder, '/');
+    auto it = folder_map.find(Str(folder));
+    if (it != folder_map.end()) return it->second;
+    u32 id = folders.size();
+    folder_iris.emplace_back(iri::from_fs_path(folder));
+    folder_hashes.emplace_back(uni::hash64(folder));
+    folders.emplace_back(move(folder));
+    folder_map.emplace(Str(folders.back()), id);
+    return id;
+}
+
+void PageTable::add (u32 folder, Str name) {
+    folder_ids.emplace_back(folder);
+    name_starts.emplace_back(names.size());
+    name_sizes.emplace_back(name.size());
+    for (char c : name) names.emplace_back(c);
+    keys.emplace_back(combine_key(folder_hashes[folder], name));
+    sizes.emplace_back();
+    bits.emplace_back();
+    flags.emplace_back();
+    stats.emplace_back();
+}
+
+void PageTable::add_path (Str path) {
+    usize split = split_path(path);
+    add(add_folder(path.slice(0, split)), path.slice(split, path.size()));
+}
+
+void PageTable::add_row (const PageTable& other, u32 i) {
+    add(add_folder(other.folder(i)), other.name(i));
+    sizes.back() = other.sizes[i];
+    bits.back() = other.bits[i];
+    flags.back() = other.flags[i];
+    stats.back() = other.stats[i];
+}
+
+void PageTable::build_index () {
+    usize cap = std::bit_ceil(max<usize>(size() * 2, 16));
+    slots = UniqueArray<u32>(cap);
+    for (u32 i = 0; i < size(); i++) {
+        usize s = keys[i] & (cap - 1);
+        while (slots[s]) s = (s + 1) & (cap - 1);
+        slots[s] = i + 1;
+    }
+}
+
+UniqueString PageTable::path (u32 i) const {
+    return cat(folder(i), name(i));
+}
+
+IRI PageTable::location (u32 i) const {
+    return iri::from_fs_path(name(i), folder_iris[folder_ids[i]]);
+}
+
+UniqueArray<IRI> PageTable::locations () const {
+    return UniqueArray<IRI>(size(), [this](usize i){ return location(i); });
+}
+
+bool PageTable::has_path (u32 i, Str f, Str n) const {
+    return folder(i) == f && name(i) == n;
+}
+
+static i32 find_split (const PageTable& self, u64 key, Str folder, Str name) {
+    i32 r = -1;
+    self.each_with_key(key, [&](u32 i){
+        if (!self.has_path(i, folder, name)) return false;
+         // Slots aren't in page order, so keep looking for an earlier one.
+        if (r < 0 || i32(i) < r) r = i;
+        return false;
+    });
+    return r;
+}
+
+i32 PageTable::find (const IRI& loc) const {
+    if (!loc) return -1;
+    UniqueString path = iri::to_fs_path(loc);
+    if (!path) return -1;
+    return find_path(path);
+}
+
+i32 PageTable::find_path (Str path) const {
+    usize split = split_path(path);
+    Str folder = path.slice(0, split);
+    Str name = path.slice(split, path.size());
+    return find_split(*this, page_key(folder, name), folder, name);
+}
+
+i32 PageTable::find_row (const PageTable& other, u32 i) const {
+    return find_split(*this, other.keys[i], other.folder(i), other.name(i));
+}
+
+i32 PageTable::find_key (u64 key) const {
+    i32 r = -1;
+    each_with_key(key, [&](u32 i){ r = i; return true; });
+    return r;
+}
+
+template <class T>
+static void permute_array (UniqueArray<T>& a, Slice<u32> order) {
+    a = UniqueArray<T>(order.size(), [&](usize i){ return a[order[i]]; });
+}
+
+void PageTable::permute (Slice<u32> order) {
+    require(order.size() == size());
+    permute_array(folder_ids, order);
+    permute_array(name_starts, order);
+    permute_array(name_sizes, order);
+    permute_array(keys, order);
+    permute_array(sizes, order);
+    permute_array(bits, order);
+    permute_array(flags, order);
+    permute_array(stats, order);
+    if (!slots.empty()) build_index();
+}
+
+void PageTable::erase (u32 i) {
+    require(i < size());
+    folder_ids.erase(i);
+    name_starts.erase(i);
+    name_sizes.erase(i);
+    keys.erase(i);
+    sizes.erase(i);
+    bits.erase(i);
+    flags.erase(i);
+    stats.erase(i);
+    if (!slots.empty()) build_index();
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/page-table", []{
+    using namespace tap;
+
+    auto locs = UniqueArray<IRI>(300, [](usize i){
+        return IRI(cat("file:///books/", i / 100, "/page", i % 100, ".png"));
+    });
+    PageTable table (locs);
+    is(table.size(), u32(300), "PageTable has all pages");
+    is(table.folders.size(), usize(3), "Folders are only stored once");
+    is(table.path(123), "/books/1/page23.png",
+        "PageTable::path puts paths back together"
+    );
+    ok(table.location(299) == locs[299], "PageTable::location");
+    bool all_found = true;
+    for (usize i = 0; i < locs.size(); i++) {
+        if (table.find(locs[i]) != i32(i)) all_found = false;
+    }
+    ok(all_found, "PageTable::find finds every page");
+    is(table.find(IRI("file:///books/3/page0.png")), -1,
+        "PageTable::find returns -1 if not found"
+    );
+    is(table.find_path("/books/2/page5.png"), 205, "PageTable::find_path");
+    is(page_key("/books/2/page5.png"), table.keys[205],
+        "page_key splits paths the same way"
+    );
+
+    PageTable raw;
+    raw.add_path("/books/a b/100%.png");
+    raw.add(raw.add_folder("/books/a b"), "x.png");
+    raw.build_index();
+    is(raw.folders.size(), usize(1), "add_folder adds a missing /");
+    is(raw.location(0).spec(), "file:///books/a%20b/100%25.png",
+        "PageTable::location encodes raw paths"
+    );
+    is(raw.find(IRI("file:///books/a%20b/x.png")), 1,
+        "PageTable::find decodes IRIs"
+    );
+
+    auto order = UniqueArray<u32>(300, [](usize i){ return u32(299 - i); });
+    table.sizes[0] = IVec(7, 5);
+    table.stats[0].size = 1234;
+    table.permute(order);
+    is(table.path(0), "/books/2/page99.png", "PageTable::permute");
+    is(table.sizes[299], IVec(7, 5), "PageTable::permute moves layout too");
+    is(table.stats[299].size, i64(1234), "PageTable::permute moves stats too");
+    is(table.find(locs[0]), 299, "PageTable::find works after permute");
+
+    PageTable copy;
+    copy.add_row(table, 299);
+    copy.build_index();
+    ok(copy.sizes[0] == IVec(7, 5) && copy.find_row(table, 299) == 0,
+        "PageTable::add_row"
+    );
+
+    table.erase(0);
+    is(table.size(), u32(299), "PageTable::erase");
+    is(table.find(locs[299]), -1, "PageTable::erase removes from index");
+    is(table.find(locs[0]), 298, "PageTable::erase moves later pages");
+
+    PageTable empty (Slice<IRI>{});
+    is(empty.find(locs[0]), -1, "Empty PageTable finds nothing");
+    is(PageTable().find_path("/a.png"), -1,
+        "PageTable without an index finds nothing"
+    );
+
+    done_testing();
+});
+#endif
@@ -0,0 +1,147 @@
+ // Compact storage for a book's page locations, and for what's known about
+ // their layout before they're loaded.  Books can have millions of pages, most
+ // of which are never looked at, so instead of each having a Page object with
+ // its own IRI, the table keeps everything in a few flat arrays.  Locations are
+ // kept as raw filesystem paths, split into a folder (stored once) and a name,
+ // and only turned into IRIs when something asks for one.
+
+#pragma once
+
+#include <limits>
+#include <unordered_map>
+#include "../dirt/geo/vec.h"
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+
+struct stat;
+
+namespace liv {
+
+enum class PageFlags : u8 {
+    None = 0,
+     // size, bits, and the Alpha flag came from the image's header (or the
+     // geometry index).
+    Probed = 0x1,
+    Alpha = 0x2,
+};
+DECLARE_ENUM_BITWISE_OPERATORS(PageFlags)
+
+ // What's known about a page's file from stat(), so sorting and the title
+ // don't have to stat() it again.  Filled in by the folder scan (if the sort
+ // needs it), by stat_pages when sorting by date or size, or by the prober in
+ // the background otherwise.  Reset when the file is seen to change.
+struct FileStat {
+    static constexpr i64 unknown = std::numeric_limits<i64>::min();
+     // nanoseconds.  Both are -1 if the file couldn't be stat()ed.
+    i64 mtime = unknown;
+    i64 size = unknown;
+     // Identifies the file, even if it's renamed.
+    u64 device = 0;
+    u64 inode = 0;
+    bool known () const { return mtime != unknown; }
+    bool failed () const { return mtime == -1; }
+
+    static FileStat from (const struct ::stat&);
+    static constexpr FileStat failure () {
+        FileStat r;
+        r.mtime = r.size = -1;
+        return r;
+    }
+};
+
+ // Identifies a page by its filesystem path.  folder must end with /.  This is
+ // also what the geometry index is keyed by.
+u64 page_key (Str folder, Str name);
+ // Splits the path after its last /.
+u64 page_key (Str path);
+
+struct PageTable {
+     // Filesystem paths of folders, ending with /.
+    UniqueArray<UniqueString> folders;
+     // The IRI of each folder, made when the folder is added, since there
+     // are far fewer folders than pages.
+    UniqueArray<IRI> folder_iris;
+    UniqueArray<u64> folder_hashes;
+     // The rest of each page's path, one after another.
+    UniqueArray<char> names;
+
+     // Per page, in page order
+    UniqueArray<u32> folder_ids;
+    UniqueArray<u32> name_starts;
+    UniqueArray<u32> name_sizes;
+     // page_key of each path
+    UniqueArray<u64> keys;
+    UniqueArray<IVec> sizes;
+    UniqueArray<u8> bits;
+    UniqueArray<PageFlags> flags;
+    UniqueArray<FileStat> stats;
+
+     // Open addressing hash table of keys, holding page index + 1 (0 is
+     // empty).  Always a power of two, at least twice the number of pages.
+     // Empty until build_index is called.
+    UniqueArray<u32> slots;
+     // For add_folder.  Points into folders.
+    std::unordered_map<Str, u32> folder_map;
+
+    PageTable () = default;
+    PageTable (PageTable&&) = default;
+    PageTable& operator= (PageTable&&) = default;
+     // Requires the locations to be file: IRIs.  Builds the index.
+    explicit PageTable (Slice<IRI> locations);
+
+     // Adding pages.  Pages added this way can't be found until build_index
+     // is called.
+
+     // Returns the folder's id, adding it if it isn't here yet.  Adds a / if
+     // path doesn't end with one.
+    u32 add_folder (Str path);
+    void add (u32 folder, Str name);
+     // Adds the folder too if needed.
+    void add_path (Str path);
+     // Copy page i of other, including what's known about its layout and
+     // file.
+    void add_row (const PageTable& other, u32 i);
+    void build_index ();
+
+    u32 size () const { return keys.size(); }
+    Str folder (u32 i) const { return folders[folder_ids[i]]; }
+    Str name (u32 i) const {
+        return Str(names.data() + name_starts[i], name_sizes[i]);
+    }
+     // The filesystem path of page i.
+    UniqueString path (u32 i) const;
+     // Makes a new IRI, so this isn't free.
+    IRI location (u32 i) const;
+    UniqueArray<IRI> locations () const;
+    bool has_path (u32 i, Str folder, Str name) const;
+
+     // All of these return -1 if not found.
+    i32 find (const IRI&) const;
+    i32 find_path (Str path) const;
+     // Find the first page with the same path as other's page i.
+    i32 find_row (const PageTable& other, u32 i) const;
+    i32 find_key (u64 key) const;
+     // Calls f with each page with this key until it returns true.  A book
+     // can have the same location more than once.
+    template <class F>
+    void each_with_key (u64 key, F f) const {
+        if (slots.empty()) return;
+        usize mask = slots.size() - 1;
+        for (usize s = key & mask; slots[s]; s = (s + 1) & mask) {
+            u32 i = slots[s] - 1;
+            if (keys[i] == key && f(i)) return;
+        }
+    }
+
+     // Rearrange pages so that the page at order[i] ends up at i.  order must
+     // be a permutation of the page indexes.  This and erase keep the index
+     // up to date if it's been built.
+    void permute (Slice<u32> order);
+     // Remove one page.  Its name stays in names until the table is rebuilt.
+    void erase (u32 i);
+};
+
+} // namespace liv
@@ -0,0 +1,148 @@
+#include "page-uploader.h"
+
+#include <cstring>
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/time.h"
+#include "page.h"
+
+namespace liv {
+
+ // How long to wait for the GPU to finish with a pixel buffer before giving
+ // the main loop a turn.  Waiting a little (instead of polling) keeps the main
+ // loop from spinning while the GPU catches up.
+static constexpr GLuint64 fence_wait_ns = 2000000;
+
+PageUploader::PageUploader () {
+    u32 ids [buffer_count];
+    glGenBuffers(buffer_count, ids);
+    for (u32 i = 0; i < buffer_count; i++) {
+        buffers[i].id = ids[i];
+    }
+}
+
+PageUploader::~PageUploader () {
+    for (auto& buf : buffers) {
+        if (buf.fence) glDeleteSync(buf.fence);
+        glDeleteBuffers(1, &buf.id);
+    }
+}
+
+void PageUploader::start (Page* p, DecodedImage&& img, bool mipmaps) {
+    expect(!page);
+    page = p;
+    image = move(img);
+    next_row = 0;
+    levels = mipmaps ? mip_level_count(image.size) : 1;
+    texture = create_page_texture(image.size, image.format, levels);
+}
+
+void PageUploader::start_tile (Page* p, PageTile* t) {
+    expect(!page);
+    expect(p->tiled() && !t->texture);
+    page = p;
+    tile = t;
+    image = p->tile_pixels(*t);
+    next_row = 0;
+    levels = 1;
+    texture = create_page_texture(image.size, image.format);
+}
+
+void PageUploader::start_overview (Page* p) {
+    expect(!page);
+    expect(p->overview_source);
+    page = p;
+    overview = true;
+    image = *p->overview_source;
+    next_row = 0;
+    levels = 1;
+    texture = create_page_texture(image.size, image.format);
+}
+
+usize PageUploader::step (usize budget) {
+    expect(page);
+    auto& buf = buffers[next_buffer];
+    if (buf.fence) {
+         // Don't block for long if the GPU is still reading this buffer;
+         // we'll come back on the next idle call.
+        auto status = glClientWaitSync(
+            buf.fence, GL_SYNC_FLUSH_COMMANDS_BIT, fence_wait_ns
+        );
+        if (status == GL_TIMEOUT_EXPIRED) return 0;
+        glDeleteSync(buf.fence);
+        buf.fence = null;
+        if (status == GL_WAIT_FAILED) {
+             // We don't know whether the GPU is done with the buffer, so
+             // give it new storage before it's written again.
+            buf.capacity = 0;
+            raise(e_General, "Could not wait for page upload buffer");
+        }
+    }
+    double start = uni::now();
+
+    u32 bpp = bytes_per_pixel(image.format);
+    usize row_bytes = usize(image.size.x) * bpp;
+    i32 rows = max(i32(1), i32(budget / row_bytes));
+    rows = min(rows, image.size.y - next_row);
+    usize bytes = rows * row_bytes;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buf.id);
+    if (buf.capacity < bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, null, GL_STREAM_DRAW);
+        buf.capacity = bytes;
+    }
+     // The fence guarantees the GPU is done with the old contents.
+    auto dest = (u8*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    require(dest);
+    const u8* src = image.pixels + usize(next_row) * image.stride;
+    if (image.stride == row_bytes) {
+        std::memcpy(dest, src, bytes);
+    }
+    else for (i32 y = 0; y < rows; y++) {
+        std::memcpy(dest + y * row_bytes, src + y * image.stride, row_bytes);
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, next_row, image.size.x, rows,
+        gl_format(image.format), GL_UNSIGNED_BYTE, (void*)0
+    );
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    buf.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    next_buffer = (next_buffer + 1) % buffer_count;
+    next_row += rows;
+    page->upload_time += uni::now() - start;
+    return bytes;
+}
+
+Page* PageUploader::finish () {
+    expect(done());
+    Page* r = page;
+    if (tile) r->set_tile_texture(*tile, move(texture));
+    else if (overview) r->set_overview_texture(move(texture));
+    else r->set_texture(move(texture), image, levels);
+    page = null;
+    tile = null;
+    overview = false;
+    image = {};
+    next_row = 0;
+    return r;
+}
+
+void PageUploader::cancel (Page* p) {
+    if (page != p) return;
+    page = null;
+    tile = null;
+    overview = false;
+    image = {};
+    texture = null;
+    next_row = 0;
+}
+
+} // namespace liv
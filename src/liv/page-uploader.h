@@ -0,0 +1,63 @@
+ // Streams decoded pixels into page textures a band of rows at a time, through
+ // a small ring of pixel buffer objects.  This keeps one huge image from
+ // stalling a whole frame.
+
+#pragma once
+
+#include "../dirt/glow/gl.h"
+#include "../dirt/glow/texture.h"
+#include "../dirt/uni/common.h"
+#include "common.h"
+#include "page-loader.h"
+
+namespace liv {
+
+struct PageUploader {
+    PageUploader ();
+    ~PageUploader ();
+
+     // Page currently being uploaded, or null.
+    Page* page = null;
+     // If uploading one tile of a tiled page, that tile.
+    PageTile* tile = null;
+     // If uploading a tiled page's overview
+    bool overview = false;
+    DecodedImage image;
+     // Not given to the page until it's filled, because the page may still be
+     // drawing an older (downscaled) texture.
+    std::unique_ptr<glow::Texture> texture;
+    u32 levels = 1;
+    i32 next_row = 0;
+
+    struct PixelBuffer {
+        u32 id = 0;
+        usize capacity = 0;
+         // Signaled when the GPU is done reading from this buffer.
+        GLsync fence = null;
+    };
+    static constexpr u32 buffer_count = 3;
+    PixelBuffer buffers [buffer_count];
+    u32 next_buffer = 0;
+
+     // Allocate a texture and start streaming into it.  If mipmaps is true,
+     // the texture will have room for a mip pyramid.
+    void start (Page*, DecodedImage&&, bool mipmaps = false);
+     // Start streaming one tile of a resident tiled page, or its overview.
+     // The page must not be unloaded without cancelling this.
+    void start_tile (Page*, PageTile*);
+    void start_overview (Page*);
+     // Upload at most about budget bytes (always at least one row).  Returns
+     // the number of bytes uploaded, which may be 0 if the GPU hasn't caught
+     // up yet (after waiting a couple milliseconds for it).  Throws if the
+     // GPU can't be waited for; the upload should be cancelled then.
+    usize step (usize budget);
+     // True if all rows have been sent.
+    bool done () const { return page && next_row >= image.size.y; }
+     // Give the filled texture to the page (or tile) and forget about it.
+     // Returns the page.
+    Page* finish ();
+     // Stop uploading this page if it's the current one.
+    void cancel (Page*);
+};
+
+} // namespace liv
@@ -1,5 +1,6 @@
 #include "page.h"
 
+#include <cmath>
 #include "../dirt/glow/program.h"
 #include "../dirt/iri/path.h"
 #include "../dirt/uni/io.h"
@@ -8,6 +9,7 @@
 #include "../dirt/ayu/resources/resource.h"
 #include "app.h"
 #include "book.h"
+#include "page-loader.h"
 
 using namespace glow;
 
@@ -19,33 +21,261 @@ Page::Page (const IRI& loc) :
 Page::~Page () { }
 
 void Page::load () {
-    if (texture) return;
+    if (state == PageState::Resident) return;
     plog("Loading page");
     load_started_at = now();
-    auto filename = iri::to_fs_path(location);
     try {
-        texture = std::make_unique<FileTexture>(filename, GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        size = texture->size();
-        estimated_memory = area(size) * ((texture->bpp() + 1) / 8);
+        upload(decode_image(iri::to_fs_path(location)));
     }
     catch (std::exception& e) {
-        ayu::warn_utf8(cat(
-            "Error loading image file ", filename,
-            ": ", e.what(), "\n"
-        ));
-        load_failed = true;
+        fail(e.what());
     }
     load_finished_at = now();
     plog("loaded page");
 }
 
+u32 gl_format (PixelFormat f) {
+    switch (f) {
+        case PixelFormat::Gray8: return GL_RED;
+        case PixelFormat::GrayAlpha8: return GL_RG;
+        case PixelFormat::RGB8: return GL_RGB;
+        case PixelFormat::RGBA8: return GL_RGBA;
+        default: never();
+    }
+}
+
+static u32 gl_internal_format (PixelFormat f) {
+    switch (f) {
+        case PixelFormat::Gray8: return GL_R8;
+        case PixelFormat::GrayAlpha8: return GL_RG8;
+        case PixelFormat::RGB8: return GL_RGB8;
+        case PixelFormat::RGBA8: return GL_RGBA8;
+        default: never();
+    }
+}
+
+void Page::upload (const DecodedImage& image) {
+    expect(image);
+    i32 max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (needs_tiles(image.size, max_size)) {
+        double start = now();
+        set_tiles(image, max_size);
+        for (auto& tile : tiles) upload_tile(tile);
+        upload_time = now() - start;
+        return;
+    }
+    double start = now();
+    auto tex = create_page_texture(image.size, image.format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image.stride / bytes_per_pixel(image.format));
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, image.size.x, image.size.y,
+        gl_format(image.format), GL_UNSIGNED_BYTE, image.pixels
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    upload_time = now() - start;
+    set_texture(move(tex), image, 1);
+}
+
+u32 mip_level_count (IVec size) {
+    u32 r = 1;
+    for (i32 s = max(size.x, size.y); s > 1; s >>= 1) r += 1;
+    return r;
+}
+
+std::unique_ptr<Texture> create_page_texture (
+    IVec size, PixelFormat format, u32 levels
+) {
+    auto r = std::make_unique<Texture>(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, *r);
+    glTexStorage2D(
+        GL_TEXTURE_2D, levels, gl_internal_format(format), size.x, size.y
+    );
+    if (levels > 1) {
+         // textureLod can only reach the lower levels with a mipmapping
+         // minification filter.  Keep the filtering within each level the
+         // same as usual.  GL_TEXTURE_MAX_LEVEL is set when drawing so the
+         // other interpolators still only see level 0.
+        GLint filter;
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+            filter == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST
+          : filter == GL_LINEAR ? GL_LINEAR_MIPMAP_NEAREST
+          : filter
+        );
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (format == PixelFormat::Gray8 || format == PixelFormat::GrayAlpha8) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        if (format == PixelFormat::GrayAlpha8) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_GREEN);
+        }
+    }
+    return r;
+}
+
+i32 page_tile_size (const Settings& settings) {
+    i32 max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    i32 setting = settings.get(&MemorySettings::tile_size);
+     // Tiles smaller than this would be mostly apron.
+    if (setting > 0) return clamp(setting, tile_apron * 8, max_size);
+    else return max_size;
+}
+
+static isize image_bytes (const DecodedImage& image) {
+    return area(image.size) * isize(bytes_per_pixel(image.format));
+}
+
+void Page::set_tiles (
+    DecodedImage image, i32 tile_size, DecodedImage overview_image
+) {
+    expect(image);
+    expect(tile_size > tile_apron * 2);
+    texture = null;
+    tiles = {};
+    overview = null;
+    overview_source = null;
+    overview_size = {};
+    size = image.original_size;
+    texture_size = image.size;
+    mip_levels = 1;
+    mips_generated = false;
+     // The pixels are held until the page is unloaded, even if they're
+     // mapped from the disk cache.
+    estimated_memory = image_bytes(image);
+    if (overview_image) {
+        expect(!needs_tiles(overview_image.size, tile_size));
+        overview_size = overview_image.size;
+        estimated_memory += image_bytes(overview_image);
+        overview_source = std::make_unique<DecodedImage>(
+            move(overview_image)
+        );
+    }
+    i32 step = tile_size - tile_apron * 2;
+    for (i32 y = 0; y < texture_size.y; y += step)
+    for (i32 x = 0; x < texture_size.x; x += step) {
+        IRect interior (
+            x, y, min(x + step, texture_size.x), min(y + step, texture_size.y)
+        );
+        IRect texels (
+            max(interior.l - tile_apron, 0),
+            max(interior.b - tile_apron, 0),
+            min(interior.r + tile_apron, texture_size.x),
+            min(interior.t + tile_apron, texture_size.y)
+        );
+        tiles.emplace_back(interior, texels);
+    }
+    tile_source = std::make_unique<DecodedImage>(move(image));
+    state = PageState::Resident;
+    upgrading = false;
+}
+
+DecodedImage Page::tile_pixels (const PageTile& tile) const {
+    expect(tile_source);
+    auto& image = *tile_source;
+    DecodedImage r = image;
+    r.size = IVec(
+        tile.texels.r - tile.texels.l, tile.texels.t - tile.texels.b
+    );
+    r.original_size = r.size;
+    r.pixels = image.pixels + usize(tile.texels.b) * image.stride
+             + usize(tile.texels.l) * bytes_per_pixel(image.format);
+    return r;
+}
+
+void Page::upload_tile (PageTile& tile) {
+    if (tile.texture) return;
+    auto image = tile_pixels(tile);
+    auto tex = create_page_texture(image.size, image.format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image.stride / bytes_per_pixel(image.format));
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, image.size.x, image.size.y,
+        gl_format(image.format), GL_UNSIGNED_BYTE, image.pixels
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    set_tile_texture(tile, move(tex));
+}
+
+void Page::set_tile_texture (PageTile& tile, std::unique_ptr<Texture> tex) {
+    expect(tex);
+    expect(!tile.texture);
+    tile.texture = move(tex);
+    IVec tsize (tile.texels.r - tile.texels.l, tile.texels.t - tile.texels.b);
+    estimated_memory += area(tsize) * bytes_per_pixel(tile_source->format);
+}
+
+void Page::set_overview_texture (std::unique_ptr<Texture> tex) {
+    expect(tex);
+    expect(overview_source);
+     // Takes the place of the source in memory.
+    overview = move(tex);
+    overview_source = null;
+}
+
+void Page::evict_tile (PageTile& tile) {
+    if (!tile.texture) return;
+    tile.texture = null;
+    IVec tsize (tile.texels.r - tile.texels.l, tile.texels.t - tile.texels.b);
+    estimated_memory -= area(tsize) * bytes_per_pixel(tile_source->format);
+    expect(estimated_memory >= 0);
+}
+
+void Page::set_texture (
+    std::unique_ptr<Texture> tex, const DecodedImage& image, u32 levels
+) {
+    expect(tex);
+    expect(levels >= 1);
+    texture = move(tex);
+    tiles = {};
+    tile_source = null;
+    overview = null;
+    overview_source = null;
+    overview_size = {};
+    size = image.original_size;
+    texture_size = image.size;
+    mip_levels = levels;
+    mips_generated = false;
+    estimated_memory = 0;
+    IVec level_size = texture_size;
+    for (u32 i = 0; i < levels; i++) {
+        estimated_memory += area(level_size) * bytes_per_pixel(image.format);
+        level_size = IVec(max(level_size.x / 2, 1), max(level_size.y / 2, 1));
+    }
+    state = PageState::Resident;
+    upgrading = false;
+}
+
+void Page::fail (Str message) {
+    ayu::warn_utf8(cat(
+        "Error loading image file ", iri::to_fs_path(location),
+        ": ", message, "\n"
+    ));
+    state = PageState::Failed;
+}
+
 void Page::unload () {
     texture = null;
     load_started_at = 0;
     load_finished_at = 0;
-    load_failed = false;
+    upload_time = 0;
+    cache_status = {};
+    state = PageState::Unloaded;
+    upgrading = false;
+    tiles = {};
+    tile_source = null;
+    overview = null;
+    overview_source = null;
+    overview_size = {};
+    mip_levels = 1;
+    mips_generated = false;
 }
 
  // These must match the constants in page.ayu#fragment
@@ -60,6 +290,7 @@ enum class Interpolator {
     Box36 = 8,
     Box49 = 9,
 //    Box64 = 10,
+    Mipmap = 11,
 };
 
 struct PageProgram : Program {
@@ -99,34 +330,24 @@ struct PageProgram : Program {
     }
 };
 
-void draw_pages (
-    Slice<PageView> views,
-    const Settings& settings,
-    Vec picture_size,
-    Vec offset,
-    float zoom
+static Interpolator choose_interpolator (
+    const Settings& settings, float zoom, bool has_mips
 ) {
-    static PageProgram* program = ayu::track(
-        program, "res:/liv/page.ayu#program"
-    );
-    program->use();
-    double view_time = uni::now();
-
-     // Shared parameters
-    auto ori = settings.get(&LayoutSettings::orientation);
-    glUniform1i(program->u_orientation, i32(ori));
-
-    Interpolator interp;
     if (zoom == 1.f) {
          // Increase chances of pixel-perfect rendering
-        interp = Interpolator::Nearest;
+        return Interpolator::Nearest;
     }
     else if (zoom > 1.f) {
         auto upscaler = settings.get(&RenderSettings::upscaler);
-        interp = Interpolator(i32(upscaler));
+        return Interpolator(i32(upscaler));
     }
     else {
         auto downscaler = settings.get(&RenderSettings::downscaler);
+        if (downscaler == Downscaler::Mipmap) {
+            if (has_mips) return Interpolator::Mipmap;
+             // This page was loaded before mipmap was selected.
+            downscaler = Downscaler::Box25;
+        }
          // Don't use higher sample count than necessary.
         Downscaler necessary =
             zoom >= 1/2.f ? Downscaler::Box9
@@ -137,9 +358,124 @@ void draw_pages (
         if (i32(downscaler) > i32(necessary)) {
             downscaler = necessary;
         }
-        interp = Interpolator(i32(downscaler));
+        return Interpolator(i32(downscaler));
     }
-    glUniform1i(program->u_interpolator, i32(interp));
+}
+
+ // Draw part of a texture.  on_screen is in picture pixels and tex_rect is in
+ // texels.
+static void draw_texture (
+    PageProgram& program, const Texture& texture, Rect on_screen,
+    Rect tex_rect, Vec picture_size
+) {
+    Rect on_picture = on_screen / picture_size * float(2) - Vec(1, 1);
+    glUniform1fv(program.u_screen_rect, 4, &on_picture.l);
+    glUniform1fv(program.u_tex_rect, 4, &tex_rect.l);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+ // Draw only the tiles that are on screen.  Tiles that aren't uploaded yet are
+ // drawn from the overview until they are, and when zoomed out far enough the
+ // overview is drawn instead of the tiles.  rect is the whole page's position
+ // on the picture.
+static void draw_tiles (
+    PageProgram& program, const Settings& settings, Page* page, Rect rect,
+    Vec picture_size, float tex_zoom, double view_time
+) {
+     // Zoom relative to the overview
+    float overview_zoom = page->overview
+        ? tex_zoom * page->texture_size.x / page->overview_size.x
+        : GINF;
+    auto use_overview = [&]{
+        auto interp = choose_interpolator(settings, overview_zoom, false);
+        glUniform1i(program.u_interpolator, i32(interp));
+        glUniform1f(program.u_zoom, overview_zoom);
+    };
+    if (overview_zoom <= 1) {
+        use_overview();
+        draw_texture(
+            program, *page->overview, rect,
+            Rect(Vec{0, 0}, page->overview_size), picture_size
+        );
+        return;
+    }
+     // Picture area covered by the page, in texture pixels.
+    Rect visible = Rect(
+        max(rect.l, 0.f), max(rect.b, 0.f),
+        min(rect.r, picture_size.x), min(rect.t, picture_size.y)
+    );
+    auto to_texels = [&](float v, float origin){
+        return (v - origin) / tex_zoom;
+    };
+    page->visible_texels = IRect(
+        i32(std::floor(to_texels(visible.l, rect.l))),
+        i32(std::floor(to_texels(visible.b, rect.b))),
+        i32(std::ceil(to_texels(visible.r, rect.l))),
+        i32(std::ceil(to_texels(visible.t, rect.b)))
+    );
+    auto& vis = page->visible_texels;
+    UniqueArray<PageTile*> missing;
+    for (auto& tile : page->tiles) {
+        auto& in = tile.interior;
+        if (in.r <= vis.l || in.l >= vis.r || in.t <= vis.b || in.b >= vis.t) {
+            continue;
+        }
+        tile.last_drawn_at = view_time;
+        if (!tile.texture) {
+            missing.emplace_back(&tile);
+            continue;
+        }
+         // Same transform as for the whole page, so the seams line up exactly.
+        Rect on_screen = Rect(
+            rect.l + in.l * tex_zoom, rect.b + in.b * tex_zoom,
+            rect.l + in.r * tex_zoom, rect.b + in.t * tex_zoom
+        );
+         // Relative to the tile's texture
+        Rect tex_rect = Rect(
+            in.l - tile.texels.l, in.b - tile.texels.b,
+            in.r - tile.texels.l, in.t - tile.texels.b
+        );
+        draw_texture(program, *tile.texture, on_screen, tex_rect, picture_size);
+    }
+     // Leave the background showing if there's no overview either.
+    if (missing.empty() || !page->overview) return;
+    use_overview();
+    Vec scale = Vec(
+        float(page->overview_size.x) / page->texture_size.x,
+        float(page->overview_size.y) / page->texture_size.y
+    );
+    for (PageTile* tile : missing) {
+        auto& in = tile->interior;
+        Rect on_screen = Rect(
+            rect.l + in.l * tex_zoom, rect.b + in.b * tex_zoom,
+            rect.l + in.r * tex_zoom, rect.b + in.t * tex_zoom
+        );
+        Rect tex_rect = Rect(
+            in.l * scale.x, in.b * scale.y, in.r * scale.x, in.t * scale.y
+        );
+        draw_texture(
+            program, *page->overview, on_screen, tex_rect, picture_size
+        );
+    }
+}
+
+void draw_pages (
+    Slice<PageView> views,
+    const Settings& settings,
+    Vec picture_size,
+    Vec offset,
+    float zoom
+) {
+    static PageProgram* program = ayu::track(
+        program, "res:/liv/page.ayu#program"
+    );
+    program->use();
+    double view_time = uni::now();
+
+     // Shared parameters
+    auto ori = settings.get(&LayoutSettings::orientation);
+    glUniform1i(program->u_orientation, i32(ori));
 
     auto deringer = settings.get(&RenderSettings::deringer);
     glUniform1i(program->u_deringer, i32(deringer));
@@ -148,8 +484,6 @@ void draw_pages (
     auto bg_scaled = Vec4(bg.r, bg.g, bg.b, bg.a) / 255.f;
     glUniform4fv(program->u_transparency_background, 1, &bg_scaled[0]);
 
-    glUniform1f(program->u_zoom, zoom);
-
     auto& color = settings.get(&RenderSettings::color_range);
     auto color_mul = geo::size(color);
     auto color_add = color.l;
@@ -157,30 +491,64 @@ void draw_pages (
     glUniform3fv(program->u_color_add, 1, &color_add[0]);
 
     for (auto& view : views) {
-        auto texture = &*view.page->texture;
+        Page* page = view.page;
          // Some validation
-        if (!texture) continue;  // Probably failed to load.
-        expect(!!*texture);
-        expect(texture->target == GL_TEXTURE_2D);
+        if (page->state != PageState::Resident) continue;  // Not loaded yet or failed
         plog("drawing page");
 
-        view.page->last_viewed_at = view_time;
+        page->last_viewed_at = view_time;
         Rect unzoomed = Rect(
             view.offset,
-            view.offset + view.page->size
+            view.offset + page->size
         );
         Rect zoomed = unzoomed * zoom + offset;
          // Snap to pixels to make diagonal seam less likely.
          // Round one corner and keep the size constant.
         Rect rounded = zoomed + (round(lb(zoomed)) - lb(zoomed));
+
+         // If the texture was downscaled, the zoom relative to the texture is
+         // higher than the zoom relative to the image.
+        float tex_zoom = zoom;
+        if (page->downscaled()) {
+            tex_zoom *= float(page->size.x) / page->texture_size.x;
+        }
+        auto interp = choose_interpolator(
+            settings, tex_zoom, page->mip_levels > 1
+        );
+        glUniform1i(program->u_interpolator, i32(interp));
+        glUniform1f(program->u_zoom, tex_zoom);
+
+        if (page->tiled()) {
+            draw_tiles(
+                *program, settings, page, rounded, picture_size, tex_zoom,
+                view_time
+            );
+            plog("drew page");
+            continue;
+        }
+
+        auto texture = page->texture.get();
+        expect(texture);
+        expect(!!*texture);
+        expect(texture->target == GL_TEXTURE_2D);
          // Convert to OpenGL coords (-1,-1)..(+1,+1)
         Rect on_picture = rounded / picture_size * float(2) - Vec(1, 1);
         glUniform1fv(program->u_screen_rect, 4, &on_picture.l);
 
-        auto tex_rect = Rect(Vec{0, 0}, view.page->size);
+        auto tex_rect = Rect(Vec{0, 0}, page->texture_size);
         glUniform1fv(program->u_tex_rect, 4, &tex_rect.l);
          // Do it
         glBindTexture(GL_TEXTURE_2D, *texture);
+        if (page->mip_levels > 1) {
+            if (interp == Interpolator::Mipmap && !page->mips_generated) {
+                plog("generating mipmaps");
+                glGenerateMipmap(GL_TEXTURE_2D);
+                page->mips_generated = true;
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                interp == Interpolator::Mipmap ? page->mip_levels - 1 : 0
+            );
+        }
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
         plog("drew page");
     }
@@ -223,6 +591,7 @@ static tap::TestSet tests ("liv/page", []{
     is(page.size, IVec(0, 0), "Page isn't loaded yet");
     page.load();
     is(page.size, IVec(7, 5), "Page has correct size");
+    is(mip_level_count(page.size), 3u, "mip_level_count");
 
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -269,6 +638,36 @@ static tap::TestSet tests ("liv/page", []{
     done:;
     ok(match, "Page program wrote correct pixels");
 
+    Page tiled (page.location);
+    tiled.set_tiles(
+        decode_image(iri::to_fs_path(tiled.location)), tile_apron * 2 + 3
+    );
+    is(tiled.tiles.size(), usize(6), "Page split into tiles");
+    is(tiled.size, IVec(7, 5), "Tiled page has correct size");
+    UniqueArray<PageView> tiled_views {
+        PageView{&tiled, Vec{0, 0}}
+    };
+    glClear(GL_COLOR_BUFFER_BIT);
+    settings.render.upscaler = Upscaler::Cubic;
+    doesnt_throw([&]{
+        draw_pages(tiled_views, settings, test_size, Vec{25, 35}, 10);
+    }, "Page::draw with tiles");
+    glFinish();
+    UniqueImage got_tiled (test_size);
+    glReadPixels(0, 0, test_size.x, test_size.y, GL_RGBA, GL_UNSIGNED_BYTE, got_tiled.pixels);
+    bool tiled_match = true;
+    for (int y = 0; y < test_size.y; y++)
+    for (int x = 0; x < test_size.x; x++) {
+        if (got_tiled[{x, y}] != got[{x, y}]) {
+            tiled_match = false;
+            diag(cat(x, ' ', y));
+            goto tiled_done;
+        }
+    }
+    tiled_done:;
+    ok(tiled_match, "Tiled page draws the same as untiled page");
+    ok(tiled.estimated_memory > 0, "Drawing uploaded tiles");
+
      // TODO: test failure to load image
     done_testing();
 });
@@ -6,7 +6,7 @@
 #include "../dirt/geo/rect.h"
 #include "../dirt/geo/scalar.h"
 #include "../dirt/geo/vec.h"
-#include "../dirt/glow/file-texture.h"
+#include "../dirt/glow/texture.h"
 #include "../dirt/iri/iri.h"
 #include "../dirt/uni/common.h"
 #include "common.h"
@@ -14,23 +14,157 @@
 
 namespace liv {
 
+enum class PixelFormat : u8;
+enum class CacheStatus : u8;
+
+enum class PageState : u8 {
+     // Nothing has been done with this page yet, or it was unloaded.
+    Unloaded,
+     // Waiting for a decode thread to pick it up.
+    Queued,
+     // A decode thread is working on it.
+    Decoding,
+     // Pixels are in memory, waiting to be uploaded.
+    Decoded,
+     // Texture is ready to draw.
+    Resident,
+     // Couldn't load this page.  Don't try again until it's unloaded.
+    Failed,
+};
+
+ // Filters read up to this many texels past the one being drawn, so tiles carry
+ // this many texels of their neighbors around their edges.
+constexpr i32 tile_apron = 4;
+
+ // Part of a page that's been split into several textures, because it's too
+ // large for one (or larger than memory.tile_size).
+struct PageTile {
+     // The part of the image this tile draws, in texture pixels.
+    IRect interior;
+     // The part of the image stored in the texture.  This is interior plus an
+     // apron of neighboring texels (except at the image's edges), so that
+     // filters sample the same values they would from a single texture.
+    IRect texels;
+     // Null if not uploaded yet or evicted.
+    std::unique_ptr<glow::Texture> texture;
+     // Last time this tile was on screen, whether or not it was uploaded
+     // yet.  Tiles that were on screen last frame but aren't uploaded get
+     // sent through the PageUploader.
+    double last_drawn_at = 0;
+};
+
 struct Page {
     IRI location;
-    std::unique_ptr<glow::FileTexture> texture;
+     // Position in the PageBlock.  Changes when the block is resorted.
+    i32 index = -1;
+     // Null if the page is tiled.
+    std::unique_ptr<glow::Texture> texture;
+     // If not empty, the page is drawn from these instead of texture, and
+     // tile_source keeps the pixels to (re)upload them from.
+    UniqueArray<PageTile> tiles;
+    std::unique_ptr<DecodedImage> tile_source;
+     // A downscaled copy of a tiled page, drawn instead of the tiles when
+     // zoomed out far enough, and in place of tiles that aren't uploaded yet.
+     // overview_source is only kept until the texture is uploaded.
+    std::unique_ptr<glow::Texture> overview;
+    std::unique_ptr<DecodedImage> overview_source;
+    IVec overview_size;
+     // Part of the texture that was on screen last time the page was drawn.
+     // Only maintained for tiled pages.
+    IRect visible_texels;
+     // Full size of the image.  This is what layout uses.  Filled in from
+     // the image's header before the page is loaded, if it's been probed.
     IVec size;
+     // From the image's header.  Only valid if probed is true.
+    u8 file_bits = 0;
+    bool file_alpha = false;
+    bool probed = false;
+     // Size of the texture.  Smaller than size if the page was downscaled for
+     // display-resolution residency.
+    IVec texture_size;
+     // Number of levels in the texture.  More than 1 if it was created for the
+     // mipmap downscaler.
+    u32 mip_levels = 1;
+     // The lower levels are filled in the first time they're drawn.
+    bool mips_generated = false;
+     // For tiled pages, this is the pixels in tile_source and the overview
+     // plus the tiles that are uploaded.
     isize estimated_memory = 0;
     double last_viewed_at = 0;
     double load_started_at = 0;
     double load_finished_at = 0;
-    bool load_failed = false;
+     // Time actually spent sending pixels to the GPU
+    double upload_time = 0;
+     // Whether the pixels came from the disk cache
+    CacheStatus cache_status {};
+     // Compressed pixels kept in system memory, so the page can be reloaded
+     // quickly after its texture is evicted.  Not cleared by unload().
+    std::shared_ptr<const CompressedImage> ram_copy;
+     // A compressed copy is being made in the background
+    bool compressing = false;
+    PageState state = PageState::Unloaded;
+     // A full-resolution version has been requested to replace a downscaled
+     // texture.  The page stays resident in the meantime.
+    bool upgrading = false;
 
     explicit Page (const IRI&);
     ~Page ();
 
+     // Decode and upload on the current thread.  Only for when you really
+     // can't wait.
     void load ();
+     // Make a texture out of decoded pixels all at once.  Must be called on
+     // the main thread.
+    void upload (const DecodedImage&);
+     // Take a texture that was filled by a PageUploader, replacing any
+     // existing texture.
+    void set_texture (
+        std::unique_ptr<glow::Texture>, const DecodedImage&, u32 levels
+    );
+     // Split a page into tiles no larger than tile_size (including aprons).
+     // The tiles aren't uploaded until they're drawn.  overview can be empty.
+    void set_tiles (DecodedImage, i32 tile_size, DecodedImage overview = {});
+     // The part of tile_source that goes in a tile's texture.  Shares its
+     // pixels.
+    DecodedImage tile_pixels (const PageTile&) const;
+     // Upload a tile on the current thread.
+    void upload_tile (PageTile&);
+     // Take a tile's texture (or the overview's) that was filled by a
+     // PageUploader.
+    void set_tile_texture (PageTile&, std::unique_ptr<glow::Texture>);
+    void set_overview_texture (std::unique_ptr<glow::Texture>);
+    void evict_tile (PageTile&);
+     // Record a failed load.
+    void fail (Str message);
+     // Drop the texture, but not ram_copy.
     void unload ();
+
+     // Currently being loaded in the background
+    bool loading () const {
+        return state == PageState::Queued
+            || state == PageState::Decoding
+            || state == PageState::Decoded;
+    }
+    bool downscaled () const { return texture_size != size; }
+    bool tiled () const { return !tiles.empty(); }
 };
 
+ // Create an empty texture to stream decoded pixels into.  Only level 0 needs
+ // to be filled in.
+std::unique_ptr<glow::Texture> create_page_texture (
+    IVec size, PixelFormat, u32 levels = 1
+);
+ // Number of levels in a full mipmap pyramid down to 1x1.
+u32 mip_level_count (IVec size);
+ // The largest texture to make for a page, from memory.tile_size and the
+ // driver's limit.  Must be called on the main thread.
+i32 page_tile_size (const Settings&);
+ // Whether an image of this size has to be split into tiles.
+inline bool needs_tiles (IVec size, i32 tile_size) {
+    return size.x > tile_size || size.y > tile_size;
+}
+u32 gl_format (PixelFormat);
+
 struct PageView {
     Page* page;
     Vec offset;  // unzoomed coordinates
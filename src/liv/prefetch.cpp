@@ -0,0 +1,91 @@
+#include "prefetch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace liv {
+
+static void prefetch_file (const UniqueString& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;  // Not our job to report this
+     // This only starts the reads; it doesn't wait for them.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+static void prefetch_thread (Prefetcher& self) {
+    std::unique_lock lock (self.mutex);
+    for (;;) {
+        self.work_cond.wait(lock, [&self]{
+            return self.stopping || !self.queue.empty();
+        });
+        if (self.stopping) return;
+        UniqueString filename = move(self.queue.front());
+        self.queue.pop_front();
+        self.working = true;
+        lock.unlock();
+
+        prefetch_file(filename);
+
+        lock.lock();
+        self.working = false;
+        self.idle_cond.notify_all();
+    }
+}
+
+Prefetcher::Prefetcher () :
+    thread([this]{ prefetch_thread(*this); })
+{ }
+
+Prefetcher::~Prefetcher () {
+    {
+        std::lock_guard lock (mutex);
+        stopping = true;
+    }
+    work_cond.notify_all();
+    thread.join();
+}
+
+void Prefetcher::request (UniqueString filename) {
+    {
+        std::lock_guard lock (mutex);
+        queue.emplace_back(move(filename));
+    }
+    work_cond.notify_one();
+}
+
+void Prefetcher::cancel () {
+    std::lock_guard lock (mutex);
+    queue.clear();
+}
+
+void Prefetcher::wait_idle () {
+    std::unique_lock lock (mutex);
+    idle_cond.wait(lock, [this]{
+        return queue.empty() && !working;
+    });
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/iri/path.h"
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/prefetch", []{
+    using namespace tap;
+
+    Prefetcher prefetcher;
+    prefetcher.request(iri::to_fs_path(
+        IRI("res/liv/test/image.png", iri::program_location())
+    ));
+    prefetcher.request("/nonexistent/file.png");
+    doesnt_throw([&]{ prefetcher.wait_idle(); }, "Prefetcher finishes queue");
+    prefetcher.request("/nonexistent/file.png");
+    prefetcher.cancel();
+    prefetcher.wait_idle();
+    ok(prefetcher.queue.empty(), "Prefetcher::cancel empties queue");
+
+    done_testing();
+});
+#endif
@@ -0,0 +1,40 @@
+ // Warms the kernel's file cache for pages past the decode window, so that by
+ // the time they're decoded their files don't have to come from a slow disk or
+ // network mount.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+
+namespace liv {
+
+ // Issues readahead hints on a background thread, because even opening a file
+ // can block on a network mount.  All methods must be called from the main
+ // thread.
+struct Prefetcher {
+    Prefetcher ();
+    ~Prefetcher ();
+
+     // Add files to the end of the queue.
+    void request (UniqueString filename);
+     // Drop everything that hasn't been started yet.
+    void cancel ();
+     // For testing.  Block until the queue is empty.
+    void wait_idle ();
+
+    std::mutex mutex;
+    std::condition_variable work_cond;
+    std::condition_variable idle_cond;
+    bool stopping = false;
+    bool working = false;
+    std::deque<UniqueString> queue;
+    std::thread thread;
+};
+
+} // namespace liv
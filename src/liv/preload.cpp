@@ -0,0 +1,194 @@
+#include "preload.h"
+
+#include <algorithm>
+#include <cmath>
+#include "../dirt/ayu/reflection/describe.h"
+#include "../dirt/geo/scalar.h"
+
+namespace liv {
+
+ // Weight of the newest seek in the averages
+static constexpr double smoothing = 0.2;
+ // Gaps longer than this are breaks, not reading speed.
+static constexpr double max_interval = 60;
+ // Don't look more than this many seeks ahead.
+static constexpr i32 max_landings = 8;
+
+void PreloadPlanner::record_seek (ReadingStats& rs, i32 delta, double now) {
+    if (!delta) return;
+    if (last_seek_at) {
+        double dt = now - last_seek_at;
+        if (dt < max_interval) {
+            rs.interval = rs.interval ? lerp(rs.interval, dt, smoothing) : dt;
+        }
+    }
+    rs.direction = lerp(rs.direction, delta > 0 ? 1.0 : -1.0, smoothing);
+    if (std::abs(delta) == std::abs(last_delta)) rs.stride = std::abs(delta);
+    last_delta = delta;
+    last_seek_at = now;
+}
+
+static void record_view (PreloadPlanner& self, i32 index) {
+    self.stats.views += 1;
+    for (i32 i : self.plan.pages) {
+        if (i == index) { self.stats.planned_hits += 1; break; }
+    }
+    if (contains(self.plan.static_window, index)) {
+        self.stats.static_hits += 1;
+    }
+}
+
+const PreloadPlan& PreloadPlanner::update (
+    const ReadingStats& rs, const Settings& settings,
+    IRange viewing, i32 count, i32 budget, double load_time
+) {
+     // Nothing's been planned yet if plan.viewing is empty.
+    if (viewing != plan.viewing && size(plan.viewing)) {
+        for (i32 i : viewing & IRange(0, count)) {
+            if (!contains(plan.viewing, i)) record_view(*this, i);
+        }
+    }
+    plan.viewing = viewing;
+
+    i32 ahead = settings.get(&MemorySettings::preload_ahead);
+    i32 behind = settings.get(&MemorySettings::preload_behind);
+    auto valid = IRange(0, count);
+    plan.static_window = IRange(viewing.l - behind, viewing.r + ahead) & valid;
+    plan.pages.clear();
+    plan.window = viewing & valid;
+
+    auto add = [&](i32 i){
+        if (!contains(valid, i) || contains(viewing, i)) return;
+        for (i32 p : plan.pages) if (p == i) return;
+        plan.pages.emplace_back(i);
+        if (i < plan.window.l) plan.window.l = i;
+        if (i >= plan.window.r) plan.window.r = i + 1;
+    };
+    auto finish = [&]() -> const PreloadPlan& {
+        plan.keep.clear();
+        for (i32 i : viewing & valid) plan.keep.emplace_back(i);
+        for (i32 i : plan.pages) plan.keep.emplace_back(i);
+        std::sort(plan.keep.begin(), plan.keep.end());
+        return plan;
+    };
+    auto add_static = [&]{
+        for (i32 i = viewing.r; i < plan.static_window.r; i++) add(i);
+        for (i32 i = viewing.l - 1; i >= plan.static_window.l; i--) add(i);
+    };
+
+    if (!settings.get(&MemorySettings::predict_preload)) {
+        add_static();
+        return finish();
+    }
+
+    i32 spread = max(size(viewing), 1);
+    i32 stride = rs.stride ? rs.stride : spread;
+     // How many seeks will probably happen while one page loads
+    i32 landings = 1;
+    if (rs.interval > 0 && load_time > 0) {
+        landings += i32(std::ceil(load_time / rs.interval));
+    }
+    landings = min(landings, max_landings);
+     // Stay within the memory budget, but always do at least the fixed
+     // window.
+    i32 static_count = size(plan.static_window) - size(viewing & valid);
+    i32 limit = max(budget - spread, static_count);
+    landings = min(landings, max(limit / spread, 1));
+
+    auto add_landing = [&](i32 dir, i32 k){
+        i32 l = viewing.l + dir * stride * k;
+        for (i32 i = l; i < l + spread; i++) add(i);
+    };
+     // Mostly going back and forth, so predict both ways.
+    bool both = std::abs(rs.direction) < 0.5;
+    i32 dir = rs.direction >= 0 ? 1 : -1;
+     // The next landing is the most likely page to be viewed.
+    add_landing(dir, 1);
+    if (both) add_landing(-dir, 1);
+    add_static();
+    for (i32 k = 2; k <= landings; k++) {
+        if (i32(plan.pages.size()) + spread > limit) break;
+        add_landing(dir, k);
+        if (both) add_landing(-dir, k);
+    }
+    return finish();
+}
+
+} using namespace liv;
+
+AYU_DESCRIBE(liv::ReadingStats,
+    attrs(
+        attr("direction", &ReadingStats::direction, optional),
+        attr("stride", &ReadingStats::stride, optional),
+        attr("interval", &ReadingStats::interval, optional)
+    )
+)
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/preload", []{
+    using namespace tap;
+
+    Settings settings;
+    settings.memory.preload_ahead = 1;
+    settings.memory.preload_behind = 1;
+    ReadingStats rs;
+    PreloadPlanner planner;
+
+    auto plan = [&](IRange viewing, i32 budget = 100, double load_time = 0){
+        UniqueString r;
+        for (i32 i : planner.update(
+            rs, settings, viewing, 100, budget, load_time
+        ).pages) {
+            if (r) encat(r, ' ');
+            encat(r, i);
+        }
+        return r;
+    };
+    is(plan({10, 11}), "11 9",
+        "Without history, plan is the fixed window"
+    );
+    is(plan({0, 1}), "1", "Plan doesn't go past the start");
+
+    double t = 100;
+    for (i32 i = 0; i < 4; i++) planner.record_seek(rs, 20, t += 1);
+    is(rs.stride, 20, "Repeated seeks set stride");
+    is(rs.interval, 1.0, "Interval is measured");
+    is(plan({10, 11}), "30 11 9", "Plan predicts next landing");
+    is(plan({10, 11}, 100, 2.5), "30 11 9 50 70 90",
+        "Plan looks further ahead when loading is slower than reading"
+    );
+    is(plan({10, 11}, 4, 2.5), "30 11 9",
+        "Plan stays within budget"
+    );
+    plan({10, 11});
+    auto& keep = planner.plan.keep;
+    ok(keep.size() == 4 && keep[0] == 9 && keep[1] == 10 && keep[2] == 11
+        && keep[3] == 30,
+        "Plan keeps only the planned pages, not the pages between them"
+    );
+    is(planner.plan.window, IRange{9, 31}, "Plan window covers planned pages");
+
+    planner.stats = {};
+    plan({30, 31});
+    is(planner.stats.views, u64(1), "View counted when viewing changes");
+    is(planner.stats.planned_hits, u64(1), "Planned hit counted");
+    is(planner.stats.static_hits, u64(0), "Static miss counted");
+
+    planner.record_seek(rs, 3600, t += 1000);
+    is(rs.interval, 1.0, "Long breaks don't count toward interval");
+
+    for (i32 i = 0; i < 20; i++) planner.record_seek(rs, -1, t += 1);
+    ok(rs.direction < -0.5, "Seeking backwards changes direction");
+    is(plan({10, 11}), "9 11", "Plan follows direction");
+
+    settings.memory.predict_preload = false;
+    for (i32 i = 0; i < 4; i++) planner.record_seek(rs, 20, t += 1);
+    is(plan({10, 11}), "11 9",
+        "Plan is the fixed window if predict_preload is off"
+    );
+
+    done_testing();
+});
+#endif
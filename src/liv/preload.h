@@ -0,0 +1,72 @@
+ // Decides which pages to preload, by predicting where the reader will go next
+ // from how they've been moving through the book.
+
+#pragma once
+
+#include "../dirt/geo/range.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "common.h"
+#include "settings.h"
+
+namespace liv {
+
+ // How the reader moves through a book.  Saved in the book's mark, so a
+ // reopened book is preloaded the same way.
+struct ReadingStats {
+     // Average direction of recent seeks, from -1 (always backward) to 1
+     // (always forward).
+    double direction = 1;
+     // Size of the latest seek that was the same size as the one before it,
+     // in pages.  0 if there hasn't been one.
+    i32 stride = 0;
+     // Average seconds between seeks, not counting long breaks.  0 if
+     // unknown.
+    double interval = 0;
+};
+
+ // For comparing the planned preload window against the old fixed one.
+struct PreloadStats {
+     // Pages that came into view
+    u64 views = 0;
+     // Of those, how many were in the plan before they came into view
+    u64 planned_hits = 0;
+     // And how many were in the fixed preload_ahead/preload_behind window
+    u64 static_hits = 0;
+};
+
+struct PreloadPlan {
+     // The pages being viewed when this was planned
+    IRange viewing = {0, 0};
+     // Pages to load, most likely to be viewed first.
+    UniqueArray<i32> pages;
+     // The viewed pages and all of pages, sorted.  These shouldn't be
+     // evicted, or they'll just be loaded again.  Pages between them can be,
+     // since with a long stride there can be a lot of them.
+    UniqueArray<i32> keep;
+     // Covers everything in keep.  Prefetching starts after this.
+    IRange window;
+     // The window preload_ahead and preload_behind would give.
+    IRange static_window;
+};
+
+struct PreloadPlanner {
+    i32 last_delta = 0;
+    double last_seek_at = 0;
+    PreloadPlan plan;
+    PreloadStats stats;
+
+     // Call when the reader seeks by delta pages.
+    void record_seek (ReadingStats&, i32 delta, double now);
+     // Plan which pages to preload around viewing, in a book of count pages.
+     // budget is about how many pages fit in memory.page_cache_mb, and
+     // load_time is about how long it takes to load a page, in seconds (0 if
+     // unknown).  If viewing has changed, first counts the pages that came
+     // into view against the previous plan.
+    const PreloadPlan& update (
+        const ReadingStats&, const Settings&,
+        IRange viewing, i32 count, i32 budget, double load_time
+    );
+};
+
+} // namespace liv
@@ -0,0 +1,489 @@
+#include "probe.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sail/sail.h>
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/hash.h"
+#include "../dirt/uni/io.h"
+#include "../dirt/uni/text.h"
+#include "book-source.h"
+#include "page-table.h"
+
+namespace liv {
+
+static bool format_has_alpha (SailPixelFormat format) {
+    switch (format) {
+        case SAIL_PIXEL_FORMAT_BPP8_GRAYSCALE_ALPHA:
+        case SAIL_PIXEL_FORMAT_BPP16_GRAYSCALE_ALPHA:
+        case SAIL_PIXEL_FORMAT_BPP32_GRAYSCALE_ALPHA:
+        case SAIL_PIXEL_FORMAT_BPP16_RGBA:
+        case SAIL_PIXEL_FORMAT_BPP16_BGRA:
+        case SAIL_PIXEL_FORMAT_BPP16_ARGB:
+        case SAIL_PIXEL_FORMAT_BPP16_ABGR:
+        case SAIL_PIXEL_FORMAT_BPP32_RGBA:
+        case SAIL_PIXEL_FORMAT_BPP32_BGRA:
+        case SAIL_PIXEL_FORMAT_BPP32_ARGB:
+        case SAIL_PIXEL_FORMAT_BPP32_ABGR:
+        case SAIL_PIXEL_FORMAT_BPP64_RGBA:
+        case SAIL_PIXEL_FORMAT_BPP64_BGRA:
+        case SAIL_PIXEL_FORMAT_BPP64_ARGB:
+        case SAIL_PIXEL_FORMAT_BPP64_ABGR:
+            return true;
+         // Palettes might have transparent entries, but we can't tell
+         // without reading the palette.
+        default: return false;
+    }
+}
+
+ImageInfo probe_image (const UniqueString& filename) {
+    sail_image* image = null;
+     // Only reads as much of the file as it needs for the header.
+    auto status = sail_probe_file(filename.c_str(), &image, null);
+    if (status != SAIL_OK) {
+        raise(e_General, cat("Could not probe image (SAIL status ", i32(status), ')'));
+    }
+    ImageInfo r;
+    r.size = IVec(image->width, image->height);
+    r.bits = sail_bits_per_pixel(image->pixel_format);
+    r.alpha = format_has_alpha(image->pixel_format);
+    sail_destroy_image(image);
+    return r;
+}
+
+u64 geometry_key (const IRI& page) {
+    return page_key(iri::to_fs_path(page));
+}
+
+const GeometryEntry* GeometryIndex::find (u64 key) const {
+    auto it = std::lower_bound(
+        entries.begin(), entries.end(), key,
+        [](const GeometryEntry& e, u64 k){ return e.key < k; }
+    );
+    if (it == entries.end() || it->key != key) return null;
+    return &*it;
+}
+
+ // The file is this followed by count packed records.
+struct GeometryHeader {
+    char magic [8];
+    u64 count;
+};
+
+struct GeometryRecord {
+    u64 key;
+    i64 file_size;
+    i64 file_mtime;
+    i32 width;
+    i32 height;
+    u8 bits;
+    u8 alpha;
+    u8 reserved [6];
+};
+
+static constexpr char geometry_magic [8] = {'L','I','V','G','E','O','0','2'};
+
+GeometryIndex read_geometry_index (const UniqueString& path) {
+    GeometryIndex r;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return r;
+    GeometryHeader h;
+    struct stat st;
+    if (read(fd, &h, sizeof(h)) != isize(sizeof(h))
+     || std::memcmp(h.magic, geometry_magic, 8) != 0
+     || fstat(fd, &st) != 0
+     || usize(st.st_size) != sizeof(h) + h.count * sizeof(GeometryRecord)
+    ) {
+        close(fd);
+        return r;
+    }
+    auto records = UniqueArray<GeometryRecord>(h.count);
+    usize bytes = h.count * sizeof(GeometryRecord);
+    bool good = read(fd, records.data(), bytes) == isize(bytes);
+    close(fd);
+    if (!good) return r;
+    r.entries = UniqueArray<GeometryEntry>(h.count, [&](usize i){
+        auto& rec = records[i];
+        GeometryEntry e;
+        e.key = rec.key;
+        e.file_size = rec.file_size;
+        e.file_mtime = rec.file_mtime;
+        e.info.size = IVec(rec.width, rec.height);
+        e.info.bits = rec.bits;
+        e.info.alpha = rec.alpha;
+        return e;
+    });
+     // Don't trust the file to be sorted.
+    std::sort(r.entries.begin(), r.entries.end(),
+        [](const GeometryEntry& a, const GeometryEntry& b){
+            return a.key < b.key;
+        }
+    );
+    return r;
+}
+
+void write_geometry_index (
+    const UniqueString& path, UniqueArray<GeometryEntry> entries
+) {
+    std::sort(entries.begin(), entries.end(),
+        [](const GeometryEntry& a, const GeometryEntry& b){
+            return a.key < b.key;
+        }
+    );
+    GeometryHeader h;
+    std::memcpy(h.magic, geometry_magic, 8);
+    h.count = entries.size();
+    auto records = UniqueArray<GeometryRecord>(entries.size(), [&](usize i){
+        auto& e = entries[i];
+        GeometryRecord rec = {};
+        rec.key = e.key;
+        rec.file_size = e.file_size;
+        rec.file_mtime = e.file_mtime;
+        rec.width = e.info.size.x;
+        rec.height = e.info.size.y;
+        rec.bits = e.info.bits;
+        rec.alpha = e.info.alpha;
+        return rec;
+    });
+
+    std::error_code code;
+    fs::create_directories(fs::path(path.c_str()).parent_path(), code);
+     // Write to a temporary file and rename, so readers never see a partial
+     // file.
+    UniqueString temp = cat(path, ".tmp");
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        raise(e_General, cat(
+            "Could not create geometry index ", temp, ": ",
+            std::strerror(errno)
+        ));
+    }
+    usize bytes = records.size() * sizeof(GeometryRecord);
+    bool good = write(fd, &h, sizeof(h)) == isize(sizeof(h))
+             && write(fd, records.data(), bytes) == isize(bytes);
+    close(fd);
+    if (!good || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        raise(e_General, cat(
+            "Could not write geometry index ", path, ": ",
+            std::strerror(errno)
+        ));
+    }
+}
+
+UniqueString geometry_index_path (const BookSource& src) {
+    auto& loc = src.location_for_mark();
+    if (!loc) return "";
+    u64 hash = uni::hash64(loc.spec());
+    char hex [16];
+    for (usize i = 0; i < 16; i++) {
+        hex[i] = uni::to_hex_digit(hash >> 60);
+        hash <<= 4;
+    }
+    return ayu::resource_filename(
+        IRI(cat(Str(hex, 16), ".geo"), geometry_folder)
+    );
+}
+
+static void probe_job (ProbeJob& job) {
+    struct stat st;
+    if (stat(job.filename.c_str(), &st) != 0) {
+        job.stat = FileStat::failure();
+        job.error = cat("Could not stat file: ", std::strerror(errno));
+        return;
+    }
+    job.stat = FileStat::from(st);
+    job.result.key = job.known.key;
+    job.result.file_size = st.st_size;
+    job.result.file_mtime =
+        i64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if (job.result.file_size == job.known.file_size
+     && job.result.file_mtime == job.known.file_mtime
+    ) {
+        job.result.info = job.known.info;
+        return;
+    }
+    try {
+        job.result.info = probe_image(job.filename);
+    }
+    catch (std::exception& e) {
+        job.error = cat(e.what());
+    }
+}
+
+static bool walk_done (const Prober& self) {
+    return self.cursor >= self.pages.size() * 2;
+}
+
+static bool has_work (const Prober& self) {
+    return !self.hurried.empty() || !self.requested.empty()
+        || !walk_done(self);
+}
+
+ // Returns -1 if the walk is done.
+static i32 next_row (Prober& self) {
+    i32 count = self.pages.size();
+    while (!walk_done(self)) {
+        u32 n = self.cursor++;
+        i32 d = (n + 1) / 2;
+        i32 i = n % 2 ? self.start + d : self.start - d;
+        if (i < 0 || i >= count || self.taken[i]) continue;
+        return i;
+    }
+    return -1;
+}
+
+ // Make a job for the next thing to probe, or null if the only thing left was
+ // rows that had already been taken.
+static std::unique_ptr<ProbeJob> take_job (Prober& self) {
+    i32 row = -1;
+    if (!self.hurried.empty()) {
+        row = self.hurried[0];
+        self.hurried.erase(usize(0));
+    }
+    else if (!self.requested.empty()) {
+        auto job = move(self.requested.front());
+        self.requested.pop_front();
+        return job;
+    }
+    else row = next_row(self);
+    if (row < 0) return null;
+    self.taken[row] = true;
+    auto job = std::make_unique<ProbeJob>();
+    job->filename = self.pages.path(row);
+    job->known.key = self.pages.keys[row];
+    if (self.known_geometry) {
+        if (auto e = self.known_geometry->find(job->known.key)) {
+            job->known = *e;
+        }
+    }
+    return job;
+}
+
+static void probe_thread (Prober& self) {
+    std::unique_lock lock (self.mutex);
+    for (;;) {
+        self.work_cond.wait(lock, [&self]{
+            return self.stopping || has_work(self);
+        });
+        if (self.stopping) return;
+        auto job = take_job(self);
+        if (!job) {
+            self.idle_cond.notify_all();
+            continue;
+        }
+        self.working.emplace_back(&*job);
+        lock.unlock();
+
+        probe_job(*job);
+
+        lock.lock();
+        for (usize i = 0; i < self.working.size(); i++) {
+            if (self.working[i] == &*job) {
+                self.working.erase(i);
+                break;
+            }
+        }
+        if (!job->cancelled) {
+             // Wake up the main loop, but only once per batch, because there
+             // can be thousands of these.
+            if (self.finished.empty()) wake_main_loop();
+            self.finished.emplace_back(move(job));
+        }
+        self.idle_cond.notify_all();
+    }
+}
+
+Prober::Prober (
+    u32 thread_count, PageTable p, i32 s, const GeometryIndex* known
+) :
+    pages(move(p)), known_geometry(known),
+    taken(pages.size()),
+    start(clamp(s, 0, max(i32(pages.size()) - 1, 0)))
+{
+    require(thread_count > 0);
+    require(!pages.size() || !pages.slots.empty());
+    threads.reserve(thread_count);
+    for (u32 i = 0; i < thread_count; i++) {
+        threads.emplace_back_expect_capacity([this]{ probe_thread(*this); });
+    }
+}
+
+Prober::~Prober () {
+    {
+        std::lock_guard lock (mutex);
+        stopping = true;
+    }
+    work_cond.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void Prober::request (
+    UniqueString filename, const GeometryEntry& known, bool urgent
+) {
+    auto job = std::make_unique<ProbeJob>(move(filename), known);
+    std::lock_guard lock (mutex);
+    if (urgent) requested.push_front(move(job));
+    else requested.push_back(move(job));
+    work_cond.notify_one();
+}
+
+void Prober::hurry (u64 key) {
+    std::lock_guard lock (mutex);
+    pages.each_with_key(key, [&](u32 i){
+        if (taken[i]) return false;
+         // Taken now so the walk skips it and it isn't hurried twice.
+        taken[i] = true;
+        hurried.emplace_back(i);
+        return true;
+    });
+}
+
+void Prober::cancel (u64 key) {
+    std::lock_guard lock (mutex);
+    bool found = false;
+    pages.each_with_key(key, [&](u32 i){
+        taken[i] = true;
+        for (usize h = 0; h < hurried.size(); h++) {
+            if (hurried[h] == i) {
+                hurried.erase(h);
+                found = true;
+                break;
+            }
+        }
+        return false;
+    });
+    if (found) return;
+    for (auto it = requested.begin(); it != requested.end(); ++it) {
+        if ((*it)->known.key == key) {
+            requested.erase(it);
+            return;
+        }
+    }
+    for (auto job : working) {
+        if (job->known.key == key) {
+            job->cancelled = true;
+            return;
+        }
+    }
+    for (usize i = 0; i < finished.size(); i++) {
+        if (finished[i]->known.key == key) {
+            finished.erase(i);
+            return;
+        }
+    }
+}
+
+UniqueArray<std::unique_ptr<ProbeJob>> Prober::take_finished () {
+    std::lock_guard lock (mutex);
+    return move(finished);
+}
+
+bool Prober::idle () {
+    std::lock_guard lock (mutex);
+    return !has_work(*this) && working.empty();
+}
+
+void Prober::wait_idle () {
+    std::unique_lock lock (mutex);
+    idle_cond.wait(lock, [this]{
+        return !has_work(*this) && working.empty();
+    });
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../dirt/iri/path.h"
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/probe", []{
+    using namespace tap;
+
+    auto filename = iri::to_fs_path(
+        IRI("res/liv/test/image.png", iri::program_location())
+    );
+    ImageInfo info = probe_image(filename);
+    is(info.size, IVec(7, 5), "probe_image gets size");
+    ok(info.bits >= 8, "probe_image gets bit depth");
+    bool threw = false;
+    try {
+        probe_image(iri::to_fs_path(
+            IRI("res/liv/test/nonexistent.png", iri::program_location())
+        ));
+    }
+    catch (std::exception&) { threw = true; }
+    ok(threw, "probe_image throws on missing file");
+
+    UniqueString path = ayu::resource_filename(
+        IRI("test.geo", geometry_folder)
+    );
+    UniqueArray<GeometryEntry> entries;
+    for (u64 i = 0; i < 5; i++) {
+        GeometryEntry e;
+        e.key = (i * 7) % 5;
+        e.file_size = 100 + e.key;
+        e.info.size = IVec(e.key, e.key * 2);
+        e.info.alpha = e.key % 2;
+        entries.emplace_back(e);
+    }
+    write_geometry_index(path, move(entries));
+    GeometryIndex index = read_geometry_index(path);
+    is(index.entries.size(), usize(5), "Geometry index round-trips");
+    auto e = index.find(3);
+    ok(e && e->file_size == 103 && e->info.size == IVec(3, 6) && e->info.alpha,
+        "GeometryIndex::find"
+    );
+    ok(!index.find(7), "GeometryIndex::find returns null if not found");
+    fs::remove(path.c_str());
+    is(read_geometry_index(path).entries.size(), usize(0),
+        "Missing geometry index is empty"
+    );
+
+    Prober prober (2);
+    GeometryEntry known;
+    prober.request(cat(filename), known, false);
+    known.file_size = fs::file_size(filename.c_str());
+    known.file_mtime = -1;
+    prober.request(cat(filename), known, true);
+    prober.wait_idle();
+    auto done = prober.take_finished();
+    is(done.size(), usize(2), "Prober finished jobs");
+    bool all_good = true;
+    for (auto& job : done) {
+        if (job->error || job->result.info.size != IVec(7, 5)) {
+            all_good = false;
+        }
+    }
+    ok(all_good, "Prober probes files that changed");
+
+    IRI locs [] = {
+        IRI("res/liv/test/image.png", iri::program_location()),
+        IRI("res/liv/test/non-image.txt", iri::program_location()),
+        IRI("res/liv/test/nonexistent.png", iri::program_location()),
+    };
+    PageTable pages (locs);
+    Prober walker (1, move(pages), 1);
+    walker.hurry(geometry_key(locs[0]));
+    walker.cancel(geometry_key(locs[2]));
+    walker.wait_idle();
+    done = walker.take_finished();
+    is(done.size(), usize(2),
+        "Prober walks its page table and skips cancelled pages"
+    );
+    bool got_image = false;
+    for (auto& job : done) {
+        if (job->known.key == geometry_key(locs[0])) {
+            got_image = !job->error && job->result.info.size == IVec(7, 5);
+        }
+    }
+    ok(got_image, "Prober probes pages from its page table");
+
+    done_testing();
+});
+#endif
@@ -0,0 +1,133 @@
+ // Reads just the headers of image files, so pages can be laid out before
+ // they're decoded.  The results are saved in a per-book geometry index, so a
+ // reopened book can be laid out without reading any of its files.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "../dirt/geo/vec.h"
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+#include "page-table.h"
+
+namespace liv {
+
+constexpr IRI geometry_folder = "data:/geometry/";
+
+struct ImageInfo {
+    IVec size;
+     // Bits per pixel, as stored in the file
+    u8 bits = 0;
+    bool alpha = false;
+};
+
+ // Throws if the file can't be read or isn't an image.  Safe to call from any
+ // thread.
+ImageInfo probe_image (const UniqueString& filename);
+
+ // What was known about a page's file last time.
+struct GeometryEntry {
+     // From geometry_key
+    u64 key = 0;
+    i64 file_size = -1;
+     // nanoseconds
+    i64 file_mtime = 0;
+    ImageInfo info;
+};
+
+ // The same as page_key of the page's filesystem path.
+u64 geometry_key (const IRI& page);
+
+struct GeometryIndex {
+     // Sorted by key
+    UniqueArray<GeometryEntry> entries;
+     // Returns null if not found.
+    const GeometryEntry* find (u64 key) const;
+};
+
+ // Returns an empty index if the file doesn't exist or is invalid.
+GeometryIndex read_geometry_index (const UniqueString& path);
+ // Sorts entries.  Throws on failure.
+void write_geometry_index (const UniqueString& path, UniqueArray<GeometryEntry>);
+ // Filesystem path of the geometry index for a book, or empty if the book
+ // doesn't have a single location.
+UniqueString geometry_index_path (const BookSource&);
+
+struct ProbeJob {
+    UniqueString filename;
+     // If the file's size and mtime still match this, it isn't read.  Its
+     // key identifies the page, since pages can move around while they're
+     // being probed.
+    GeometryEntry known;
+    bool cancelled = false;
+     // Filled in by the probe thread.  stat is filled in even if probing
+     // fails.
+    GeometryEntry result;
+    FileStat stat;
+     // Empty if probing succeeded
+    UniqueString error;
+};
+
+ // A pool of threads that probe image files.  All methods must be called from
+ // the main thread.
+ //
+ // Most of the work is every page of a book, which is read straight out of a
+ // copy of the book's page table, outward from the page that was current when
+ // the prober was made.  Books can have millions of pages, so there isn't a
+ // job for each one until a thread picks it up.  Pages that are hurried or
+ // requested individually are kept in short lists that are probed first.
+struct Prober {
+     // pages doesn't need its layout or stats, just its paths and keys, and
+     // must have its index built.  known must outlive the prober, and is only
+     // read.
+    explicit Prober (
+        u32 thread_count, PageTable pages = {}, i32 start = 0,
+        const GeometryIndex* known = null
+    );
+    ~Prober ();
+
+     // Queue a page that isn't in pages (or has changed since) to be probed.
+     // Urgent pages go to the front.
+    void request (
+        UniqueString filename, const GeometryEntry& known, bool urgent
+    );
+     // Probe a page soon, if it hasn't been started yet.
+    void hurry (u64 key);
+     // Forget about a page because it's being removed.
+    void cancel (u64 key);
+     // Take all finished jobs.
+    UniqueArray<std::unique_ptr<ProbeJob>> take_finished ();
+     // Nothing is queued or being probed.
+    bool idle ();
+     // For testing.  Block until idle.
+    void wait_idle ();
+
+    std::mutex mutex;
+    std::condition_variable work_cond;
+    std::condition_variable idle_cond;
+    bool stopping = false;
+    PageTable pages;
+    const GeometryIndex* known_geometry;
+     // Per row of pages, whether it's been picked up or cancelled.
+    UniqueArray<bool> taken;
+    i32 start;
+     // How far the outward walk through pages has gotten.  Goes up to twice
+     // the number of pages, since it alternates sides of start.
+    u32 cursor = 0;
+     // Rows of pages that were hurried, in order.
+    UniqueArray<u32> hurried;
+     // Pages that were requested individually
+    std::deque<std::unique_ptr<ProbeJob>> requested;
+    UniqueArray<ProbeJob*> working;
+    UniqueArray<std::unique_ptr<ProbeJob>> finished;
+    UniqueArray<std::thread> threads;
+};
+
+} // namespace liv
@@ -0,0 +1,506 @@
+#include "scan.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../dirt/iri/path.h"
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/text.h"
+
+namespace liv {
+
+namespace {
+
+struct ScanJob {
+    ScannedFolder* folder;
+     // The same folder from the previous scan, if there was one.  Its
+     // contents are moved out if it hasn't changed.
+    ScannedFolder* previous;
+};
+
+ // Each thread pushes and pops the back of its own queue, which keeps the walk
+ // mostly depth-first.  Thieves take from the front, where the folders closest
+ // to the root (and so probably the biggest) are.
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<ScanJob> jobs;
+};
+
+struct Scanner {
+    Slice<AnyString> extensions;
+    const FoundFirst* found_first;
+    bool want_stats = false;
+    const std::atomic<bool>* stop = null;
+    std::atomic<bool> found_any = false;
+     // Folders that had to be read instead of reused
+    std::atomic<usize> read_count = 0;
+    u32 thread_count;
+    std::unique_ptr<WorkQueue[]> queues;
+     // Folders in queues
+    std::atomic<usize> queued = 0;
+     // Folders in queues or being read
+    std::atomic<usize> pending = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cond;
+};
+
+} // namespace
+
+static bool stopping (const Scanner& self) {
+    return self.stop && *self.stop;
+}
+
+static void push_job (Scanner& self, u32 worker, ScanJob job) {
+    self.pending += 1;
+    {
+        std::lock_guard lock (self.queues[worker].mutex);
+        self.queues[worker].jobs.emplace_back(job);
+    }
+    self.queued += 1;
+     // Lock so a thread can't miss this between checking and sleeping.
+    { std::lock_guard lock (self.sleep_mutex); }
+    self.sleep_cond.notify_one();
+}
+
+static bool pop_job (Scanner& self, u32 worker, ScanJob& job) {
+    {
+        auto& own = self.queues[worker];
+        std::lock_guard lock (own.mutex);
+        if (!own.jobs.empty()) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            self.queued -= 1;
+            return true;
+        }
+    }
+    for (u32 i = 1; i < self.thread_count; i++) {
+        auto& other = self.queues[(worker + i) % self.thread_count];
+        std::lock_guard lock (other.mutex);
+        if (!other.jobs.empty()) {
+            job = other.jobs.front();
+            other.jobs.pop_front();
+            self.queued -= 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void found_file (Scanner& self, const ScannedFolder& folder, Str name) {
+    if (*self.found_first && !self.found_any.exchange(true)) {
+        (*self.found_first)(iri::from_fs_path(cat(folder.path, name)));
+    }
+}
+
+static void add_subfolder (
+    Scanner& self, u32 worker, ScannedFolder& folder, Str name,
+    ScannedFolder* previous
+) {
+    auto sub = std::make_unique<ScannedFolder>();
+    sub->path = cat(folder.path, name, '/');
+    push_job(self, worker, {&*sub, previous});
+    folder.subfolders.emplace_back(folder.names.size(), move(sub));
+}
+
+ // Reuse the previous scan of this folder.  Its subfolders still have to be
+ // checked, because changes inside them don't change this folder's mtime.
+static void reuse_folder (
+    Scanner& self, u32 worker, ScannedFolder& folder, ScannedFolder& previous
+) {
+    usize f = 0;
+    for (auto& [pos, sub] : previous.subfolders) {
+        for (; f < pos; f++) {
+            found_file(self, folder, previous.names[f]);
+            folder.names.emplace_back(move(previous.names[f]));
+        }
+        Str name = Str(sub->path).slice(
+            previous.path.size(), sub->path.size() - 1
+        );
+        add_subfolder(self, worker, folder, name, &*sub);
+    }
+    for (; f < previous.names.size(); f++) {
+        found_file(self, folder, previous.names[f]);
+        folder.names.emplace_back(move(previous.names[f]));
+    }
+}
+
+static void read_folder (
+    Scanner& self, u32 worker, ScannedFolder& folder,
+    ScannedFolder* previous
+) {
+    int fd = open(folder.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+     // Ignore folders we can't read, like before.
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        folder.mtime = i64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        folder.inode = st.st_ino;
+        folder.device = st.st_dev;
+    }
+    if (previous && previous->mtime == folder.mtime
+     && previous->inode == folder.inode && previous->device == folder.device
+    ) {
+        close(fd);
+        reuse_folder(self, worker, folder, *previous);
+        return;
+    }
+    self.read_count += 1;
+    DIR* d = fdopendir(fd);
+    if (!d) { close(fd); return; }
+     // readdir gets the entry types along with the names, so most entries
+     // don't need to be opened or stat()ed.
+    while (dirent* ent = readdir(d)) {
+         // Huge folders on slow mounts can take a long time.
+        if (stopping(self)) break;
+        Str name = ent->d_name;
+        expect(name);
+        if (name[0] == '.') continue;
+        bool is_dir;
+        switch (ent->d_type) {
+            case DT_DIR: is_dir = true; break;
+            case DT_REG: is_dir = false; break;
+             // Symlinks, and filesystems that don't fill in d_type
+            default: {
+                is_dir = fstatat(fd, ent->d_name, &st, 0) == 0
+                      && S_ISDIR(st.st_mode);
+                break;
+            }
+        }
+        if (is_dir) {
+             // Subfolders that were here before might not have changed.
+            ScannedFolder* prev_sub = null;
+            if (previous) {
+                UniqueString sub_path = cat(folder.path, name, '/');
+                for (auto& [_, sub] : previous->subfolders) {
+                    if (sub->path == sub_path) { prev_sub = &*sub; break; }
+                }
+            }
+            add_subfolder(self, worker, folder, name, prev_sub);
+        }
+        else {
+             // Failure to open is delayed until we load the page.
+            auto ext = ascii_to_lower(iri::path_extension(name));
+            for (auto& e : self.extensions) {
+                if (e == ext) goto pick;
+            }
+            continue;
+            pick:
+            found_file(self, folder, name);
+            folder.names.emplace_back(name);
+            if (self.want_stats) {
+                folder.stats.emplace_back(
+                    fstatat(fd, ent->d_name, &st, 0) == 0
+                        ? FileStat::from(st) : FileStat::failure()
+                );
+            }
+        }
+    }
+    closedir(d);
+}
+
+static void scan_worker (Scanner& self, u32 worker) {
+    for (;;) {
+        ScanJob job;
+        if (pop_job(self, worker, job)) {
+             // Still have to drain the queues to finish.
+            if (!stopping(self)) {
+                read_folder(self, worker, *job.folder, job.previous);
+            }
+            if (--self.pending == 0) {
+                { std::lock_guard lock (self.sleep_mutex); }
+                self.sleep_cond.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock lock (self.sleep_mutex);
+        self.sleep_cond.wait(lock, [&self]{
+            return self.pending == 0 || self.queued > 0;
+        });
+        if (self.pending == 0) return;
+    }
+}
+
+usize ScannedFolder::count_pages () const {
+    usize r = names.size();
+    for (auto& [_, sub] : subfolders) r += sub->count_pages();
+    return r;
+}
+
+void ScannedFolder::add_to (PageTable& table) const {
+    u32 id = table.add_folder(path);
+    usize f = 0;
+    auto add = [&](usize f){
+        table.add(id, names[f]);
+        if (!stats.empty()) table.stats.back() = stats[f];
+    };
+    for (auto& [pos, sub] : subfolders) {
+        for (; f < pos; f++) add(f);
+        sub->add_to(table);
+    }
+    for (; f < names.size(); f++) add(f);
+}
+
+std::unique_ptr<ScannedFolder> scan_folder_tree (
+    Str folder, Slice<AnyString> extensions,
+    ScannedFolder* previous, bool* changed, u32 threads,
+    const FoundFirst& found_first, bool want_stats,
+    const std::atomic<bool>* stop
+) {
+    if (!threads) {
+         // This is mostly waiting on the filesystem, so more threads than
+         // cores is fine, but there's not much point past a few.
+        threads = clamp(std::thread::hardware_concurrency(), 2u, 8u);
+    }
+    Scanner self;
+    self.extensions = extensions;
+    self.found_first = &found_first;
+    self.want_stats = want_stats;
+    self.stop = stop;
+    self.thread_count = threads;
+    self.queues = std::make_unique<WorkQueue[]>(threads);
+
+    auto root = std::make_unique<ScannedFolder>();
+    root->path = folder;
+    if (!root->path || root->path[root->path.size() - 1] != '/') {
+        encat(root->path, '/');
+    }
+    if (previous && previous->path != root->path) previous = null;
+     // Read the top folder on this thread, and only start other threads if
+     // it has subfolders.
+    self.pending += 1;
+    read_folder(self, 0, *root, previous);
+    self.pending -= 1;
+    if (self.pending) {
+        auto workers = UniqueArray<std::thread>(Capacity(threads - 1));
+        for (u32 i = 1; i < threads; i++) {
+            workers.emplace_back_expect_capacity([&self, i]{
+                scan_worker(self, i);
+            });
+        }
+        scan_worker(self, 0);
+        for (auto& t : workers) t.join();
+    }
+     // What was found is incomplete, so don't let it be mistaken for the
+     // real thing.
+    if (stopping(self)) {
+        raise(e_General, cat("Scan of ", folder, " was stopped"));
+    }
+    if (changed) *changed = !previous || self.read_count > 0;
+    return root;
+}
+
+PageTable scan_folder (
+    Str folder, Slice<AnyString> extensions, u32 threads,
+    const FoundFirst& found_first, const std::atomic<bool>* stop
+) {
+    auto tree = scan_folder_tree(
+        folder, extensions, null, null, threads, found_first, false, stop
+    );
+    PageTable r;
+    tree->add_to(r);
+    r.build_index();
+    return r;
+}
+
+BackgroundScan::BackgroundScan (Function f) {
+    thread = std::thread([this, f = move(f)]{
+        auto found = [this](const IRI& iri){
+            {
+                std::lock_guard lock (mutex);
+                if (first) return;
+                 // Copy the IRI so the other thread never touches its
+                 // reference count.
+                first = IRI(cat(iri.spec()));
+            }
+            wake_main_loop();
+        };
+        PageTable r;
+        std::exception_ptr e;
+        try { r = f(found, stop); }
+        catch (...) { e = std::current_exception(); }
+        {
+            std::lock_guard lock (mutex);
+            result = move(r);
+            error = move(e);
+            finished = true;
+        }
+        done_cond.notify_all();
+        wake_main_loop();
+    });
+}
+
+BackgroundScan::~BackgroundScan () {
+    stop = true;
+    thread.join();
+}
+
+IRI BackgroundScan::take_first () {
+    std::lock_guard lock (mutex);
+    if (first_taken || !first) return IRI();
+    first_taken = true;
+    return move(first);
+}
+
+bool BackgroundScan::done () {
+    std::lock_guard lock (mutex);
+    return finished;
+}
+
+PageTable BackgroundScan::take_result () {
+    std::lock_guard lock (mutex);
+    require(finished);
+    if (error) std::rethrow_exception(move(error));
+    return move(result);
+}
+
+void BackgroundScan::wait () {
+    std::unique_lock lock (mutex);
+    done_cond.wait(lock, [this]{ return finished; });
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include <filesystem>
+#include <fstream>
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/tap/tap.h"
+#include "../dirt/uni/errors.h"
+
+static tap::TestSet tests ("liv/scan", []{
+    using namespace tap;
+
+    IRI folder ("data:/test-scan/");
+    UniqueString base = ayu::resource_filename(folder);
+    std::error_code code;
+    fs::remove_all(base.c_str(), code);
+    for (i32 i = 0; i < 6; i++) {
+        for (i32 j = 0; j < 4; j++) {
+            UniqueString dir = cat(base, "/d", i, "/e", j);
+            fs::create_directories(dir.c_str());
+            for (i32 k = 0; k < 3; k++) {
+                std::ofstream(cat(dir, "/p", k, ".png").c_str());
+            }
+            std::ofstream(cat(dir, "/notes.txt").c_str());
+        }
+        std::ofstream(cat(base, "/d", i, "/cover.PNG").c_str());
+    }
+    fs::create_directories(cat(base, "/.hidden").c_str());
+    std::ofstream(cat(base, "/.hidden/p.png").c_str());
+    std::ofstream(cat(base, "/.p.png").c_str());
+
+    UniqueString root = iri::to_fs_path(iri::from_fs_path(cat(base, '/')));
+    AnyString exts [] = {"png"};
+    auto one = scan_folder(root, exts, 1);
+    is(one.size(), u32(6 * 4 * 3 + 6), "scan_folder finds the right files");
+    bool all_png = true;
+    for (u32 i = 0; i < one.size(); i++) {
+        if (ascii_to_lower(iri::path_extension(one.name(i))) != "png") {
+            all_png = false;
+        }
+    }
+    ok(all_png, "scan_folder filters by extension");
+    is(one.folders.size(), usize(1 + 6 + 6 * 4),
+        "scan_folder stores each folder once"
+    );
+    auto many = scan_folder(root, exts, 4);
+    bool same = one.size() == many.size();
+    for (u32 i = 0; same && i < one.size(); i++) {
+        if (one.path(i) != many.path(i)) same = false;
+    }
+    ok(same, "Order doesn't depend on thread count");
+    is(scan_folder(cat(root, "d0/e0/"), exts).size(),
+        u32(3), "scan_folder works without subfolders"
+    );
+
+    IRI first;
+    {
+        BackgroundScan scan ([&](
+            const FoundFirst& found, const std::atomic<bool>& stop
+        ){
+            return scan_folder(root, exts, 4, found, &stop);
+        });
+        scan.wait();
+        first = scan.take_first();
+        ok(first, "BackgroundScan reports the first page found");
+        ok(!scan.take_first(), "The first page is only taken once");
+        is(scan.take_result().size(), one.size(),
+            "BackgroundScan returns the scan's result"
+        );
+    }
+    ok(one.find(first) >= 0, "The first page found is one of the pages");
+    {
+        BackgroundScan scan ([](
+            const FoundFirst&, const std::atomic<bool>&
+        ) -> PageTable {
+            raise(e_General, "oops");
+        });
+        scan.wait();
+        bool threw = false;
+        try { scan.take_result(); }
+        catch (std::exception&) { threw = true; }
+        ok(threw, "BackgroundScan rethrows errors");
+    }
+    {
+        std::atomic<bool> stop = true;
+        throws<std::exception>([&]{
+            scan_folder(root, exts, 4, null, &stop);
+        }, "scan_folder throws if it's stopped");
+    }
+    doesnt_throw([&]{
+        BackgroundScan scan ([&](
+            const FoundFirst& found, const std::atomic<bool>& stop
+        ){
+            return scan_folder(root, exts, 4, found, &stop);
+        });
+    }, "BackgroundScan can be destroyed before it's done");
+
+    bool changed = true;
+    auto tree = scan_folder_tree(root, exts);
+    auto again = scan_folder_tree(root, exts, &*tree, &changed);
+    ok(!changed, "Rescanning an unchanged tree doesn't read anything");
+    is(again->count_pages(), usize(one.size()),
+        "Rescanning an unchanged tree finds the same files"
+    );
+    std::ofstream(cat(base, "/d3/e1/p9.png").c_str());
+    auto third = scan_folder_tree(root, exts, &*again, &changed);
+    ok(changed, "Rescan notices a new file");
+    PageTable files;
+    third->add_to(files);
+    files.build_index();
+    is(files.size(), one.size() + 1, "Rescan finds the new file");
+    ok(files.find(iri::from_fs_path(cat(base, "/d3/e1/p9.png"))) >= 0,
+        "Rescan finds the new file in the right folder"
+    );
+
+    auto with_stats = scan_folder_tree(
+        root, exts, &*third, null, 0, null, true
+    );
+    PageTable stated;
+    with_stats->add_to(stated);
+    bool all_known = true;
+    for (u32 i = 0; i < stated.size(); i++) {
+        if (stated.stats[i].known()) continue;
+        all_known = false;
+    }
+    ok(!all_known, "Reused folders don't keep stats");
+    auto fresh = scan_folder_tree(root, exts, null, null, 0, null, true);
+    PageTable fresh_table;
+    fresh->add_to(fresh_table);
+    all_known = true;
+    for (u32 i = 0; i < fresh_table.size(); i++) {
+        if (fresh_table.stats[i].size != 0) all_known = false;
+    }
+    ok(all_known, "scan_folder_tree can stat files");
+
+    fs::remove_all(base.c_str(), code);
+    done_testing();
+});
+#endif
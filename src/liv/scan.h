@@ -0,0 +1,112 @@
+ // Finds the pages in a folder tree.  Big trees (especially on network mounts)
+ // are read with several threads, each taking folders from its own queue and
+ // stealing from the others' when it runs out.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+#include "page-table.h"
+
+namespace liv {
+
+ // Called with the first page a scan finds, from whichever thread found it.
+using FoundFirst = std::function<void(const IRI&)>;
+
+ // One folder from a scan, kept so that the next scan of the same tree can
+ // skip the folders that haven't changed.
+struct ScannedFolder {
+     // Filesystem path, ending with /
+    UniqueString path;
+     // From stat().  A folder's mtime changes whenever an entry is added,
+     // removed, or renamed in it, so if these are the same, so are its
+     // entries.
+    i64 mtime = -1;
+    u64 inode = 0;
+    u64 device = 0;
+     // Filenames of pages directly in this folder, in the order they were
+     // read.  IRIs aren't made for them, because most of them will never be
+     // looked at.
+    UniqueArray<UniqueString> names;
+     // Same length as names if the scan was asked for stats, otherwise
+     // empty.  Not kept when the folder is reused, since a file's contents
+     // can change without its folder changing.
+    UniqueArray<FileStat> stats;
+     // Each with how many of names came before it, so the results can be put
+     // back in the order they were read.
+    UniqueArray<std::pair<usize, std::unique_ptr<ScannedFolder>>> subfolders;
+
+    usize count_pages () const;
+     // Add all pages in this tree to table, in depth-first order.
+    void add_to (PageTable& table) const;
+};
+
+ // List files under folder (a filesystem path, recursively) whose lowercased extensions are in
+ // extensions, skipping hidden files and folders.  The results are in the
+ // order a depth-first walk on one thread would find them, no matter how the
+ // work is split between threads, so sorting them is deterministic even for
+ // sort methods with ties.  threads = 0 picks a count automatically.  If stop
+ // is given and gets set, the scan gives up as soon as it can and throws.
+PageTable scan_folder (
+    Str folder, Slice<AnyString> extensions, u32 threads = 0,
+    const FoundFirst& found_first = null,
+    const std::atomic<bool>* stop = null
+);
+
+ // Like scan_folder, but returns the whole tree.  If previous is a tree from
+ // an earlier scan of the same folder, folders in it that haven't changed are
+ // reused instead of read (and their contents are moved out of previous).  If
+ // changed isn't null, it's set to whether anything had to be read.  If
+ // want_stats is true, files in folders that are read are stat()ed too, which
+ // is cheaper than doing it later since the scan's threads are already there.
+std::unique_ptr<ScannedFolder> scan_folder_tree (
+    Str folder, Slice<AnyString> extensions,
+    ScannedFolder* previous = null, bool* changed = null, u32 threads = 0,
+    const FoundFirst& found_first = null, bool want_stats = false,
+    const std::atomic<bool>* stop = null
+);
+
+ // Runs a function that lists a book's pages on a background thread, so the
+ // book can be shown before they've all been found.  Wakes up the main loop
+ // when the first page is found and when it's done.  All methods must be
+ // called from the main thread.  The function is given a flag that's set when
+ // the scan is no longer wanted, which it should pass on to scan_folder.
+struct BackgroundScan {
+    using Function = std::function<
+        PageTable(const FoundFirst&, const std::atomic<bool>& stop)
+    >;
+    explicit BackgroundScan (Function);
+     // Sets stop and blocks until the function returns.
+    ~BackgroundScan ();
+
+     // Returns the first page found, once.  Returns empty if no page has
+     // been found yet or it was already taken.
+    IRI take_first ();
+    bool done ();
+     // Requires done().  Rethrows anything the function threw.
+    PageTable take_result ();
+     // Block until done.
+    void wait ();
+
+    std::mutex mutex;
+    std::condition_variable done_cond;
+    bool finished = false;
+    bool first_taken = false;
+    IRI first;
+    PageTable result;
+    std::exception_ptr error;
+    std::atomic<bool> stop = false;
+    std::thread thread;
+};
+
+} // namespace liv
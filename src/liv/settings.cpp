@@ -32,6 +32,7 @@ Settings builtin_default_settings = {
     .layout = {
         .spread_count = {1},
         .spread_direction = {Direction::Right},
+        .continuous = {false},
         .auto_zoom_mode = {AutoZoomMode::Fit},
         .max_zoom = {32},
         .min_zoomed_size = {16},
@@ -60,12 +61,23 @@ Settings builtin_default_settings = {
         .page_extensions = {StaticArray<AnyString>(
             extensions, sizeof(extensions)/sizeof(extensions[0])
         )},
+        .watch = {false},
     },
     .memory = {
         .preload_ahead = {1},
         .preload_behind = {1},
+        .predict_preload = {true},
+        .prefetch_ahead = {16},
         .page_cache_mb = {200},
+        .ram_cache_mb = {256},
+        .eviction_policy = {EvictionPolicy::LRU},
         .trim_when_minimized = {TrimMode::PageCache},
+        .decode_threads = {0},
+        .upload_budget_kb = {16384},
+        .residency = {Residency::Full},
+        .tile_size = {0},
+        .pyramid_cache_mb = {4096},
+        .disk_cache_mb = {0},
     },
     .mappings = { },
 };
@@ -104,6 +116,7 @@ void Settings::merge (Settings&& o) {
     LIV_MERGE(window.last_prompt_command)
     LIV_MERGE(layout.spread_count)
     LIV_MERGE(layout.spread_direction)
+    LIV_MERGE(layout.continuous)
     LIV_MERGE(layout.auto_zoom_mode)
     LIV_MERGE(layout.max_zoom)
     LIV_MERGE(layout.min_zoomed_size)
@@ -122,10 +135,21 @@ void Settings::merge (Settings&& o) {
     LIV_MERGE(control.scroll_speed)
     LIV_MERGE(files.sort)
     LIV_MERGE(files.page_extensions)
+    LIV_MERGE(files.watch)
     LIV_MERGE(memory.preload_ahead)
     LIV_MERGE(memory.preload_behind)
+    LIV_MERGE(memory.predict_preload)
+    LIV_MERGE(memory.prefetch_ahead)
     LIV_MERGE(memory.page_cache_mb)
+    LIV_MERGE(memory.ram_cache_mb)
+    LIV_MERGE(memory.eviction_policy)
     LIV_MERGE(memory.trim_when_minimized)
+    LIV_MERGE(memory.decode_threads)
+    LIV_MERGE(memory.upload_budget_kb)
+    LIV_MERGE(memory.residency)
+    LIV_MERGE(memory.tile_size)
+    LIV_MERGE(memory.pyramid_cache_mb)
+    LIV_MERGE(memory.disk_cache_mb)
 #undef LIV_MERGE
     mappings.reserve(mappings.size() + o.mappings.size());
     o.mappings.consume([this](Mapping&& m){
@@ -198,7 +222,8 @@ AYU_DESCRIBE(liv::Downscaler,
         value("box16", Downscaler::Box16),
         value("box25", Downscaler::Box25),
         value("box36", Downscaler::Box36),
-        value("box49", Downscaler::Box49)
+        value("box49", Downscaler::Box49),
+        value("mipmap", Downscaler::Mipmap)
     )
 )
 
@@ -218,6 +243,21 @@ AYU_DESCRIBE(liv::TrimMode,
     )
 )
 
+AYU_DESCRIBE(liv::Residency,
+    values(
+        value("full", Residency::Full),
+        value("display", Residency::Display)
+    )
+)
+
+AYU_DESCRIBE(liv::EvictionPolicy,
+    values(
+        value("lru", EvictionPolicy::LRU),
+        value("distance", EvictionPolicy::Distance),
+        value("cost", EvictionPolicy::CostAware)
+    )
+)
+
 AYU_DESCRIBE(liv::Mapping,
     elems(
         elem(&Mapping::input),
@@ -238,6 +278,7 @@ AYU_DESCRIBE(liv::LayoutSettings,
     attrs(
         attr("spread_count", &LayoutSettings::spread_count, collapse_optional),
         attr("spread_direction", &LayoutSettings::spread_direction, collapse_optional),
+        attr("continuous", &LayoutSettings::continuous, collapse_optional),
         attr("auto_zoom_mode", &LayoutSettings::auto_zoom_mode, collapse_optional),
         attr("reset_on_seek", &LayoutSettings::reset_on_seek, collapse_optional),
         attr("max_zoom", &LayoutSettings::max_zoom, collapse_optional),
@@ -269,7 +310,8 @@ AYU_DESCRIBE(liv::ControlSettings,
 AYU_DESCRIBE(liv::FilesSettings,
     attrs(
         attr("sort", &FilesSettings::sort, collapse_optional),
-        attr("page_extensions", &FilesSettings::page_extensions, collapse_optional)
+        attr("page_extensions", &FilesSettings::page_extensions, collapse_optional),
+        attr("watch", &FilesSettings::watch, collapse_optional)
     )
 )
 
@@ -277,8 +319,18 @@ AYU_DESCRIBE(liv::MemorySettings,
     attrs(
         attr("preload_ahead", &MemorySettings::preload_ahead, collapse_optional),
         attr("preload_behind", &MemorySettings::preload_behind, collapse_optional),
+        attr("predict_preload", &MemorySettings::predict_preload, collapse_optional),
+        attr("prefetch_ahead", &MemorySettings::prefetch_ahead, collapse_optional),
         attr("page_cache_mb", &MemorySettings::page_cache_mb, collapse_optional),
-        attr("trim_when_minimized", &MemorySettings::trim_when_minimized, collapse_optional)
+        attr("ram_cache_mb", &MemorySettings::ram_cache_mb, collapse_optional),
+        attr("eviction_policy", &MemorySettings::eviction_policy, collapse_optional),
+        attr("trim_when_minimized", &MemorySettings::trim_when_minimized, collapse_optional),
+        attr("decode_threads", &MemorySettings::decode_threads, collapse_optional),
+        attr("upload_budget_kb", &MemorySettings::upload_budget_kb, collapse_optional),
+        attr("residency", &MemorySettings::residency, collapse_optional),
+        attr("tile_size", &MemorySettings::tile_size, collapse_optional),
+        attr("pyramid_cache_mb", &MemorySettings::pyramid_cache_mb, collapse_optional),
+        attr("disk_cache_mb", &MemorySettings::disk_cache_mb, collapse_optional)
     )
 )
 
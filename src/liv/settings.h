@@ -73,6 +73,7 @@ enum class Downscaler {
     Box25 = 7,
     Box36 = 8,
     Box49 = 9,
+    Mipmap = 11,
 };
 
 using ColorRange = geo::GRange<Vec3>;
@@ -82,6 +83,17 @@ enum class TrimMode {
     PageCache
 };
 
+enum class Residency {
+    Full,
+    Display
+};
+
+enum class EvictionPolicy {
+    LRU,
+    Distance,
+    CostAware
+};
+
 struct Mapping {
     control::Input input;
     control::Statement action;
@@ -104,6 +116,7 @@ struct LayoutSettings {
     std::optional<i32> spread_count;
     static constexpr i32 max_spread_count = 16;
     std::optional<Direction> spread_direction;
+    std::optional<bool> continuous;
     std::optional<AutoZoomMode> auto_zoom_mode;
     std::optional<float> max_zoom;
     std::optional<float> min_zoomed_size;
@@ -129,12 +142,23 @@ struct FilesSettings {
     std::optional<SortMethod> sort;
      // Keep these in order
     std::optional<AnyArray<AnyString>> page_extensions;
+    std::optional<bool> watch;
 };
 struct MemorySettings {
     std::optional<u32> preload_ahead;
     std::optional<u32> preload_behind;
+    std::optional<bool> predict_preload;
+    std::optional<u32> prefetch_ahead;
     std::optional<double> page_cache_mb;
+    std::optional<double> ram_cache_mb;
+    std::optional<EvictionPolicy> eviction_policy;
     std::optional<TrimMode> trim_when_minimized;
+    std::optional<u32> decode_threads;
+    std::optional<u32> upload_budget_kb;
+    std::optional<Residency> residency;
+    std::optional<i32> tile_size;
+    std::optional<double> pyramid_cache_mb;
+    std::optional<double> disk_cache_mb;
 };
 
 extern Settings builtin_default_settings;
@@ -1,27 +1,158 @@
 #include "sort.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <random>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include "../dirt/ayu/reflection/describe.h"
 #include "../dirt/ayu/traversal/from-tree.h"
 #include "../dirt/ayu/traversal/to-tree.h"
 #include "../dirt/iri/path.h"
 #include "../dirt/uni/text.h"
 #include "common.h"
+#include "page-table.h"
 
 namespace liv {
 
-using ModTime = decltype(fs::last_write_time(fs::path()));
 using C = SortCriterion;
 using F = SortFlags;
 
+ // Filesystem paths of the things being sorted, one after another.  Each is
+ // followed by a NUL so it can be passed to the filesystem.
+struct SortPaths {
+    UniqueArray<char> chars;
+    UniqueArray<u32> starts;
+
+    void add (Str folder, Str name) {
+        starts.emplace_back(chars.size());
+        for (char c : folder) chars.emplace_back(c);
+        for (char c : name) chars.emplace_back(c);
+        chars.emplace_back('\0');
+    }
+    u32 size () const { return starts.size(); }
+    const char* c_str (u32 i) const { return chars.data() + starts[i]; }
+     // Only valid until the next add.
+    UniqueArray<Str> strs () const {
+        return UniqueArray<Str>(size(), [this](usize i){
+            usize end = i + 1 < size() ? starts[i+1] : chars.size();
+            return Str(c_str(i), end - starts[i] - 1);
+        });
+    }
+};
+
+ ///// Natural sort keys
+ // Comparing two paths naturally means finding and parsing their digit runs
+ // every time they're compared, which is O(n log n) times for a sort.  Instead,
+ // each path is turned into a key once, and the keys are compared with
+ // memcmp.  Keys are:
+ //   - / becomes 0x01, so folders' contents sort before anything else that
+ //     starts with the folder's name.
+ //   - Other bytes below '0' are shifted up by one to make room for that.
+ //   - A run of digits becomes '0', then the run's length without leading
+ //     zeros (as one byte, or 0xff and four big-endian bytes if it's that
+ //     long), then the digits.  Longer numbers are bigger, and numbers of
+ //     the same length compare digit by digit.
+ //   - Bytes after '9' are unchanged.
+
+static void append_natural_key (UniqueArray<char>& key, Str path) {
+    for (usize i = 0; i < path.size();) {
+        u8 c = path[i];
+        if (c >= '0' && c <= '9') {
+            while (i < path.size() && path[i] == '0') i++;
+            usize start = i;
+            while (i < path.size() && path[i] >= '0' && path[i] <= '9') i++;
+             // A run of only zeros is still zero.
+            if (start == i) start -= 1;
+            usize len = i - start;
+            key.emplace_back('0');
+            if (len < 0xff) key.emplace_back(char(len));
+            else {
+                key.emplace_back(char(0xff));
+                for (i32 shift = 24; shift >= 0; shift -= 8) {
+                    key.emplace_back(char(u32(len) >> shift));
+                }
+            }
+            for (usize j = start; j < i; j++) key.emplace_back(path[j]);
+            continue;
+        }
+        if (c == '/') key.emplace_back(char(0x01));
+        else if (c < '0') key.emplace_back(char(c + 1));
+        else key.emplace_back(char(c));
+        i++;
+    }
+}
+
+static bool key_lessthan (Str a, Str b) {
+    int r = std::memcmp(a.data(), b.data(), min(a.size(), b.size()));
+    return r ? r < 0 : a.size() < b.size();
+}
+
+ // Below this many items, threads aren't worth starting.
+static constexpr usize parallel_sort_threshold = 1 << 15;
+
+static u32 sort_thread_count (usize len) {
+    if (len < parallel_sort_threshold) return 1;
+    return clamp<u32>(
+        min<usize>(std::thread::hardware_concurrency(),
+                   len / (parallel_sort_threshold / 2)),
+        1, 16
+    );
+}
+
+ // Calls f(0) through f(n-1) on n threads, including this one.
+template <class F>
+static void run_parallel (u32 n, const F& f) {
+    if (n <= 1) { if (n) f(0); return; }
+    auto threads = UniqueArray<std::thread>(Capacity(n - 1));
+    for (u32 t = 1; t < n; t++) {
+        threads.emplace_back_expect_capacity([&f, t]{ f(t); });
+    }
+    f(0);
+    for (auto& t : threads) t.join();
+}
+
+ // Makes the natural sort key of each path, in parallel if there are a lot
+ // of them.  The keys point into storage.
+static UniqueArray<Str> natural_keys (
+    Slice<Str> paths, UniqueArray<UniqueArray<char>>& storage
+) {
+    plog("making sort keys");
+    usize len = paths.size();
+    u32 threads = sort_thread_count(len);
+    storage = UniqueArray<UniqueArray<char>>(threads);
+    auto r = UniqueArray<Str>(len);
+    run_parallel(threads, [&](u32 t){
+        usize begin = len * t / threads;
+        usize end = len * (t + 1) / threads;
+        auto& buf = storage[t];
+        auto starts = UniqueArray<usize>(Capacity(end - begin + 1));
+        for (usize i = begin; i < end; i++) {
+            starts.emplace_back_expect_capacity(buf.size());
+            append_natural_key(buf, paths[i]);
+        }
+        starts.emplace_back_expect_capacity(buf.size());
+         // buf is done moving, so now the keys can point into it.
+        for (usize i = begin; i < end; i++) {
+            usize start = starts[i - begin];
+            r[i] = Str(buf.data() + start, starts[i - begin + 1] - start);
+        }
+    });
+    return r;
+}
+
  // Go through a bit of work to only instantiate a single copy of
  // std::stable_sort
 struct Comparator {
     using Cmp = bool (const Comparator&, u32, u32) noexcept;
 
-    IRI* iris;
-    void* props;
+     // Paths, or natural sort keys for C::Natural
+    const Str* paths;
+     // mtimes or sizes for C::LastModified and C::FileSize
+    const i64* props;
     Cmp* f; // Should point to an instantiation of cmp
 
     bool operator() (u32 a, u32 b) const noexcept {
@@ -30,59 +161,206 @@ struct Comparator {
 
     template <SortMethod method>
     static bool cmp (const Comparator& self, u32 a, u32 b) noexcept {
-        auto iris = self.iris;
-        auto modtimes = (ModTime*)self.props;
-        auto sizes = (usize*)self.props;
+        auto paths = self.paths;
+        auto props = self.props;
         if constexpr (method.flags % F::Reverse) {
             u32 t = a; a = b; b = t;
         }
         switch (method.criterion) {
             case C::Natural: {
-                expect(iris[a].has_path());
-                expect(iris[b].has_path());
-                return uni::natural_lessthan_path(
-                    iris[a].path(),
-                    iris[b].path()
-                );
+                return key_lessthan(paths[a], paths[b]);
             }
             case C::Unicode: {
-                expect(iris[a].has_path());
-                expect(iris[b].has_path());
                  // Make sure we put UTF-8 high bytes after ASCII bytes.  If we
                  // have to go this far, we should consider making strings hold
                  // char8_t by default instead of char...
-                return GenericStr<char8_t>(iris[a].path()) <
-                       GenericStr<char8_t>(iris[b].path());
-            }
-            case C::LastModified: {
-                return modtimes[a] < modtimes[b];
+                return GenericStr<char8_t>(paths[a]) <
+                       GenericStr<char8_t>(paths[b]);
             }
+            case C::LastModified:
             case C::FileSize: {
-                return sizes[a] < sizes[b];
+                return props[a] < props[b];
             }
             default: never();
         }
     }
 };
 
+static Comparator::Cmp* pick_cmp (SortMethod method) {
+#define LIV_SORT_CMP(crit) \
+    case C::crit: return method.flags % F::Reverse \
+        ? &Comparator::cmp<SortMethod{C::crit, F::Reverse}> \
+        : &Comparator::cmp<SortMethod{C::crit, F::None}>;
+    switch (method.criterion) {
+        LIV_SORT_CMP(Natural)
+        LIV_SORT_CMP(Unicode)
+        LIV_SORT_CMP(LastModified)
+        LIV_SORT_CMP(FileSize)
+        default: never();
+    }
+#undef LIV_SORT_CMP
+}
+
+ // Like std::stable_sort, but sorts pieces on separate threads and then
+ // merges them (also in parallel) if there are a lot of items.
 NOINLINE static
-void sort_with_props (
-    IRI* iris, u32 len, Comparator::Cmp* cmp, void* props
+void parallel_stable_sort (UniqueArray<u32>& items, const Comparator& cmp) {
+    usize len = items.size();
+    u32 threads = sort_thread_count(len);
+    if (threads <= 1) {
+        std::stable_sort(items.begin(), items.end(), cmp);
+        return;
+    }
+    auto runs = UniqueArray<usize>(threads + 1, [&](usize i){
+        return len * i / threads;
+    });
+    run_parallel(threads, [&](u32 t){
+        std::stable_sort(
+            items.begin() + runs[t], items.begin() + runs[t+1], cmp
+        );
+    });
+     // Merge neighboring runs until there's only one.  std::merge takes from
+     // the first run on ties, so this stays stable.
+    auto buf = UniqueArray<u32>(len);
+    u32* from = items.data();
+    u32* to = buf.data();
+    while (runs.size() > 2) {
+        usize run_count = runs.size() - 1;
+        u32 pairs = (run_count + 1) / 2;
+        run_parallel(pairs, [&](u32 p){
+            usize l = runs[2*p];
+            usize m = runs[min<usize>(2*p + 1, run_count)];
+            usize r = runs[min<usize>(2*p + 2, run_count)];
+            std::merge(from + l, from + m, from + m, from + r, to + l, cmp);
+        });
+        auto merged = UniqueArray<usize>(pairs + 1, [&](usize p){
+            return runs[min<usize>(2*p, run_count)];
+        });
+        runs = move(merged);
+        std::swap(from, to);
+    }
+    if (from != items.data()) {
+        std::memcpy(items.data(), from, len * sizeof(u32));
+    }
+}
+
+ ///// Gathering file stats
+ // Sorting by date or size needs a stat() per file.  On a network filesystem
+ // each one is a round trip, so they're done by a lot of threads at once,
+ // each taking batches of paths as it finishes the last.
+
+static constexpr usize stat_batch_size = 64;
+
+static u32 stat_thread_count (usize len) {
+    return clamp<usize>(len / (stat_batch_size * 4), 1, 32);
+}
+
+ // Calls store(i, FileStat) for each path.
+template <class F>
+static void stat_paths (const SortPaths& paths, const F& store) {
+    plog("starting stats");
+    usize len = paths.size();
+    std::atomic<usize> next = 0;
+    run_parallel(stat_thread_count(len), [&](u32){
+        for (;;) {
+            usize begin = next.fetch_add(stat_batch_size);
+            if (begin >= len) return;
+            usize end = min(begin + stat_batch_size, len);
+            for (usize i = begin; i < end; i++) {
+                FileStat r = FileStat::failure();
+                struct statx st;
+                 // Attributes the client already has cached are fine.
+                if (statx(
+                    AT_FDCWD, paths.c_str(i), AT_STATX_DONT_SYNC,
+                    STATX_MTIME | STATX_SIZE | STATX_INO, &st
+                ) == 0) {
+                    r.mtime = i64(st.stx_mtime.tv_sec) * 1000000000
+                            + st.stx_mtime.tv_nsec;
+                    r.size = st.stx_size;
+                    r.device = makedev(st.stx_dev_major, st.stx_dev_minor);
+                    r.inode = st.stx_ino;
+                }
+                store(i, r);
+            }
+        }
+    });
+    plog("finished stats");
+}
+
+ // Returns the indexes of paths in sorted order.  Sorts an array of indexes
+ // as a proxy for the actual array.  We need to do this because
+ // std::stable_sort doesn't give the comparing function a way to see the
+ // current indexes of the items it's comparing (and you can't compare the
+ // addresses of the passed-in references, because they may be in a temporary
+ // buffer or already moved).  Moving 4-byte integers is also much cheaper than
+ // moving IRIs or strings around.
+ // props are the mtimes or sizes of the paths for C::LastModified or
+ // C::FileSize.  If it's null, they're gathered here.
+NOINLINE static
+UniqueArray<u32> sort_order (
+    const SortPaths& paths, SortMethod method, const i64* props = null
 ) {
-     // Sort an array of indexes as a proxy for the actual array of IRIs.  We
-     // need to do this because std::stable_sort doesn't give the comparing
-     // function a way to see the current indexes of the items it's comparing
-     // (and you can't compare the addresses of the passed-in references,
-     // because they may be in a temporary buffer or already moved).  However,
-     // since moving 4-byte integers is much cheaper than 24-byte IRIs, this
-     // ends up being slightly faster than sorting the IRI array, at least for
-     // large sets (and it's much faster than sorting an array of std::pair<IRI,
-     // ModTime> or such).
-    auto indexes = std::unique_ptr<u32[]>(new u32[len]);
-    for (usize i = 0; i < len; i++) {
-        indexes[i] = i;
+    u32 len = paths.size();
+    auto indexes = UniqueArray<u32>(len, [](usize i){ return u32(i); });
+    if (len <= 1) return indexes;
+    plog("starting sort");
+    auto strs = paths.strs();
+    switch (method.criterion) {
+        case C::Natural: {
+            UniqueArray<UniqueArray<char>> storage;
+            auto keys = natural_keys(strs, storage);
+            parallel_stable_sort(
+                indexes, Comparator(keys.data(), null, pick_cmp(method))
+            );
+            break;
+        }
+        case C::Unicode: {
+            parallel_stable_sort(
+                indexes, Comparator(strs.data(), null, pick_cmp(method))
+            );
+            break;
+        }
+        case C::LastModified:
+        case C::FileSize: {
+            UniqueArray<i64> gathered;
+            if (!props) {
+                bool by_date = method.criterion == C::LastModified;
+                gathered = UniqueArray<i64>(len);
+                stat_paths(paths, [&](usize i, FileStat st){
+                    gathered[i] = by_date ? st.mtime : st.size;
+                });
+                props = gathered.data();
+            }
+            parallel_stable_sort(
+                indexes, Comparator(strs.data(), props, pick_cmp(method))
+            );
+            break;
+        }
+        case C::Shuffle: {
+             // We don't need that high-quality of randomness.
+            static std::minstd_rand gen (
+                std::chrono::system_clock::now().time_since_epoch().count()
+            );
+            std::shuffle(indexes.begin(), indexes.end(), gen);
+            break;
+        }
+        case C::Unsorted: break;
+        default: never();
+    }
+    plog("sorted");
+    return indexes;
+}
+
+NOINLINE
+void sort_iris (IRI* iris, IRI* end, SortMethod method) {
+    u32 len = end - iris;
+    if (len <= 1) return;
+    SortPaths paths;
+    for (u32 i = 0; i < len; i++) {
+        expect(iris[i].has_path());
+        paths.add(iri::to_fs_path(iris[i]), "");
     }
-    std::stable_sort(&indexes[0], &indexes[0] + len, Comparator(iris, props, cmp));
+    auto indexes = sort_order(paths, method);
      // Now reorder the input according to the sorted indexes.  This algorithm
      // looks wild but it works and is O(n).  Basically, we're finding closed
      // loops of indexes, and rotating the items backwards along that loop.
@@ -117,64 +395,89 @@ void sort_with_props (
     }
 }
 
-NOINLINE
-void sort_iris (IRI* begin, IRI* end, SortMethod method) {
-    usize len = end - begin;
-    if (len <= 1) return;
-    plog("starting sort");
-    switch (method.criterion) {
-        case C::Natural: {
-            auto cmp = method.flags % F::Reverse
-                ? &Comparator::cmp<SortMethod{C::Natural, F::Reverse}>
-                : &Comparator::cmp<SortMethod{C::Natural, F::None}>;
+void stat_pages (PageTable& table, u32 begin, u32 end) {
+    end = min(end, table.size());
+    SortPaths paths;
+    UniqueArray<u32> which;
+    for (u32 i = begin; i < end; i++) {
+        if (table.stats[i].known()) continue;
+        paths.add(table.folder(i), table.name(i));
+        which.emplace_back(i);
+    }
+    if (which.empty()) return;
+    stat_paths(paths, [&](usize i, FileStat st){
+        table.stats[which[i]] = st;
+    });
+}
 
-            sort_with_props(begin, len, cmp, null);
-            break;
-        }
-        case C::Unicode: {
-            auto cmp = method.flags % F::Reverse
-                ? &Comparator::cmp<SortMethod{C::Unicode, F::Reverse}>
-                : &Comparator::cmp<SortMethod{C::Unicode, F::None}>;
+UniqueArray<u32> page_sort_order (
+    PageTable& table, SortMethod method, u32 begin, u32 end
+) {
+    end = min(end, table.size());
+    auto r = UniqueArray<u32>(table.size(), [](usize i){ return u32(i); });
+    if (end <= begin + 1) return r;
+    SortPaths paths;
+    for (u32 i = begin; i < end; i++) paths.add(table.folder(i), table.name(i));
+    UniqueArray<i64> props;
+    if (method.criterion == C::LastModified
+     || method.criterion == C::FileSize
+    ) {
+        stat_pages(table, begin, end);
+        bool by_date = method.criterion == C::LastModified;
+        props = UniqueArray<i64>(end - begin, [&](usize i){
+            auto& st = table.stats[begin + i];
+            return by_date ? st.mtime : st.size;
+        });
+    }
+    auto order = sort_order(
+        paths, method, props.empty() ? null : props.data()
+    );
+    for (u32 i = 0; i < order.size(); i++) r[begin + i] = begin + order[i];
+    return r;
+}
 
-            sort_with_props(begin, len, cmp, null);
-            break;
-        }
-        case C::LastModified: {
-            auto cmp = method.flags % F::Reverse
-                ? &Comparator::cmp<SortMethod{C::LastModified, F::Reverse}>
-                : &Comparator::cmp<SortMethod{C::LastModified, F::None}>;
-
-            auto modtimes = std::unique_ptr<ModTime[]>(new ModTime[len]);
-            for (u32 i = 0; i < len; i++) {
-                modtimes[i] = fs::last_write_time(iri::to_fs_path(begin[i]));
-            }
-            sort_with_props(begin, len, cmp, &modtimes[0]);
-            break;
-        }
-        case C::FileSize: {
-            auto cmp = method.flags % F::Reverse
-                ? &Comparator::cmp<SortMethod{C::FileSize, F::Reverse}>
-                : &Comparator::cmp<SortMethod{C::FileSize, F::None}>;
+void sort_pages (PageTable& table, SortMethod method, u32 begin, u32 end) {
+    if (method.criterion == C::Unsorted) return;
+    table.permute(page_sort_order(table, method, begin, end));
+}
 
-            auto sizes = std::unique_ptr<usize[]>(new usize[len]);
-            for (u32 i = 0; i < len; i++) {
-                sizes[i] = fs::file_size(iri::to_fs_path(begin[i]));
-            }
-            sort_with_props(begin, len, cmp, &sizes[0]);
-            break;
-        }
-        case C::Shuffle: {
-             // We don't need that high-quality of randomness.
-            static std::minstd_rand gen (
-                std::chrono::system_clock::now().time_since_epoch().count()
-            );
-            std::shuffle(begin, end, gen);
-            break;
-        }
-        case C::Unsorted: break;
-        default: never();
+bool sort_is_mergeable (SortMethod method) {
+    return method.criterion == C::Natural || method.criterion == C::Unicode;
+}
+
+NOINLINE
+PageTable merge_sorted_pages (
+    const PageTable& sorted, const PageTable& added, SortMethod method
+) {
+    require(sort_is_mergeable(method));
+    plog("merging pages");
+     // The comparator works on indexes, so put both tables side by side.
+    u32 old_len = sorted.size();
+    u32 len = old_len + added.size();
+    SortPaths paths;
+    for (u32 i = 0; i < old_len; i++) {
+        paths.add(sorted.folder(i), sorted.name(i));
     }
-    plog("sorted");
+    for (u32 i = 0; i < added.size(); i++) {
+        paths.add(added.folder(i), added.name(i));
+    }
+    auto strs = paths.strs();
+    UniqueArray<UniqueArray<char>> storage;
+    if (method.criterion == C::Natural) strs = natural_keys(strs, storage);
+    Comparator comparator (strs.data(), null, pick_cmp(method));
+     // Like std::merge, but taking from sorted on ties, so that merging is
+     // stable the same way sorting everything would be (as long as added came
+     // after sorted in the listing order).
+    PageTable r;
+    u32 a = 0, b = old_len;
+    while (a < old_len && b < len) {
+        if (comparator(b, a)) r.add_row(added, b++ - old_len);
+        else r.add_row(sorted, a++);
+    }
+    while (a < old_len) r.add_row(sorted, a++);
+    while (b < len) r.add_row(added, b++ - old_len);
+    r.build_index();
+    return r;
 }
 
 struct SortMethodToken : SortMethod { };
@@ -247,7 +550,10 @@ AYU_DESCRIBE(liv::SortMethod,
 )
 
 #ifndef TAP_DISABLE_TESTS
+#include <fstream>
+#include "../dirt/ayu/resources/resource.h"
 #include "../dirt/tap/tap.h"
+#include "../dirt/uni/time.h"
 
 static tap::TestSet tests ("liv/sort", []{
     using namespace tap;
@@ -272,6 +578,138 @@ static tap::TestSet tests ("liv/sort", []{
     }
     ok(sorted);
 
+    PageTable half;
+    PageTable other;
+    for (usize i = 0; i < 2000; i++) {
+        half.add_path(cat("/", dist(gen)));
+        other.add_path(cat("/", dist(gen)));
+    }
+    auto method = SortMethod{C::Natural, F::Reverse};
+    sort_pages(half, method);
+    sort_pages(other, method);
+    auto merged = merge_sorted_pages(half, other, method);
+    is(merged.size(), u32(4000), "merge_sorted_pages keeps everything");
+    sorted = true;
+    for (u32 i = 0; i < merged.size() - 1; i++) {
+        sorted &= !uni::natural_lessthan(merged.name(i), merged.name(i+1));
+    }
+    ok(sorted, "merge_sorted_pages keeps things sorted");
+    ok(merged.find_row(other, 0) >= 0, "merge_sorted_pages builds the index");
+
+    PageTable part;
+    for (i32 i = 5; i > 0; i--) part.add_path(cat("/", i));
+    sort_pages(part, SortMethod{C::Natural, F::None}, 1, 4);
+    ok(part.name(0) == "5" && part.name(1) == "2" && part.name(3) == "4"
+        && part.name(4) == "1",
+        "sort_pages only sorts the given range"
+    );
+
+    auto key_lt = [](Str a, Str b){
+        UniqueArray<char> ka, kb;
+        append_natural_key(ka, a);
+        append_natural_key(kb, b);
+        return key_lessthan(
+            Str(ka.data(), ka.size()), Str(kb.data(), kb.size())
+        );
+    };
+    ok(key_lt("/a/b", "/a-b") && !key_lt("/a-b", "/a/b"),
+        "Sort keys put separators first"
+    );
+    ok(key_lt("/p9.png", "/p10.png") && key_lt("/p10.png", "/p10a.png"),
+        "Sort keys compare digit runs by value"
+    );
+    ok(key_lt("/p0.png", "/p1.png") && !key_lt("/p007", "/p7")
+        && !key_lt("/p7", "/p007"),
+        "Sort keys ignore leading zeros"
+    );
+    ok(key_lt("/p1!", "/p1a") && key_lt("/p", "/p0"),
+        "Sort keys keep byte order outside digit runs"
+    );
+
+     // Benchmark: sort a million paths the way sort_iris used to (comparing
+     // them directly, on one thread), and with sort keys.
+    {
+        std::uniform_int_distribution folder_dist(0, 999);
+        PageTable big;
+        for (usize i = 0; i < 1000000; i++) {
+            big.add_path(cat(
+                "/books/", folder_dist(gen), "/page ", dist(gen), ".png"
+            ));
+        }
+        auto paths = UniqueArray<UniqueString>(big.size(), [&](usize i){
+            return big.path(i);
+        });
+        auto reference = UniqueArray<u32>(big.size(), [](usize i){
+            return u32(i);
+        });
+        double start = uni::now();
+        std::stable_sort(reference.begin(), reference.end(),
+            [&](u32 a, u32 b){
+                return uni::natural_lessthan_path(paths[a], paths[b]);
+            }
+        );
+        double old_time = uni::now() - start;
+        start = uni::now();
+        auto order = page_sort_order(big, SortMethod{C::Natural, F::None});
+        double new_time = uni::now() - start;
+        bool same = order.size() == reference.size();
+        for (usize i = 0; same && i < order.size(); i++) {
+            if (paths[order[i]] != paths[reference[i]]) same = false;
+        }
+        ok(same, "Sort keys sort the same as natural_lessthan_path");
+        diag(cat(
+            "Natural sort of ", big.size(), " paths: ", old_time,
+            "s comparing paths, ", new_time, "s with sort keys"
+        ));
+        auto reversed = page_sort_order(
+            big, SortMethod{C::Natural, F::Reverse}
+        );
+        same = true;
+        for (usize i = 0; same && i < order.size(); i++) {
+            if (paths[reversed[i]] != paths[order[order.size() - 1 - i]]) {
+                same = false;
+            }
+        }
+        ok(same, "Parallel sort works in reverse");
+    }
+
+    {
+        UniqueString folder = ayu::resource_filename(IRI("data:/test-sort/"));
+        std::error_code code;
+        fs::remove_all(folder.c_str(), code);
+        fs::create_directories(folder.c_str());
+        PageTable files;
+         // Enough files to use a few threads, with sizes out of order with
+         // their names.
+        for (i32 i = 0; i < 600; i++) {
+            UniqueString path = cat(folder, "/f", i);
+            std::ofstream(path.c_str()) << std::string((i * 7) % 600, 'x');
+            files.add_path(path);
+        }
+        files.add_path(cat(folder, "/missing"));
+        files.build_index();
+        sort_pages(files, SortMethod{C::FileSize, F::None});
+        bool by_size = files.stats[0].size == -1;
+        for (u32 i = 1; i < files.size() - 1; i++) {
+            if (files.stats[i].size > files.stats[i+1].size) by_size = false;
+        }
+        ok(by_size, "Sorting by size stats in parallel");
+        is(files.name(0), "missing", "Files that can't be stat()ed go first");
+         // Change a file behind the table's back.  Resorting should use the
+         // stats it already has.
+        std::ofstream(cat(folder, "/f0").c_str()) << "xxxxxxxxxxxxxxxx";
+        sort_pages(files, SortMethod{C::FileSize, F::Reverse});
+        i32 f0 = files.find_path(cat(folder, "/f0"));
+        ok(f0 >= 0 && files.stats[f0].size == 0,
+            "Stats are kept in the table for resorting"
+        );
+        fs::remove_all(folder.c_str(), code);
+    }
+
+    IRI spaced [] = {IRI("file:///b%20c"), IRI("file:///b!")};
+    sort_iris(spaced, spaced + 2, SortMethod{C::Unicode, F::None});
+    is(spaced[0].spec(), "file:///b%20c", "sort_iris sorts by raw path");
+
     done_testing();
 });
 #endif
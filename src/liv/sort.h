@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../dirt/uni/arrays.h"
 #include "../dirt/uni/common.h"
 #include "common.h"
 
@@ -31,6 +32,35 @@ struct SortMethod {
     friend bool operator== (SortMethod a, SortMethod b) = default;
 };
 
+struct PageTable;
+
+ // These all sort by filesystem path, not by IRI.  Big sorts are spread over
+ // several threads.
 void sort_iris (IRI* begin, IRI* end, SortMethod method);
 
+ // Fill in the stats of pages [begin, end) that don't have them yet, with
+ // many stat()s in flight at once.
+void stat_pages (PageTable&, u32 begin = 0, u32 end = u32(-1));
+
+ // Returns a permutation of the table's pages (for PageTable::permute) that
+ // sorts pages [begin, end) and leaves the rest where they are.  Sorting by
+ // date or size uses (and fills in) the table's stats.
+UniqueArray<u32> page_sort_order (
+    PageTable&, SortMethod method, u32 begin = 0, u32 end = u32(-1)
+);
+void sort_pages (
+    PageTable&, SortMethod method, u32 begin = 0, u32 end = u32(-1)
+);
+
+ // Whether pages sorted by this method can have more pages merged into them
+ // without sorting them all again.  Only true for criteria that depend on
+ // nothing but the paths.
+bool sort_is_mergeable (SortMethod method);
+
+ // Merge added (sorted by sort_pages with the same method) into sorted.
+ // Requires sort_is_mergeable(method).  The result has its index built.
+PageTable merge_sorted_pages (
+    const PageTable& sorted, const PageTable& added, SortMethod method
+);
+
 } // liv
@@ -0,0 +1,363 @@
+#include "watch.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../dirt/iri/path.h"
+#include "../dirt/uni/errors.h"
+#include "../dirt/uni/hash.h"
+#include "../dirt/uni/io.h"
+#include "../dirt/uni/text.h"
+#include "../dirt/uni/time.h"
+
+namespace liv {
+
+ // Send a batch once nothing has happened for this long...
+static constexpr double watch_quiet_time = 0.25;
+ // ...or once it's been collecting for this long, whichever comes first.
+static constexpr double watch_max_time = 2;
+
+static constexpr u32 watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+    | IN_CREATE | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+namespace {
+
+ // Changes that haven't been handed over yet.
+struct Pending {
+     // By hash of spec, whether the file is there now.  A file that's added
+     // and then removed within a batch (or the other way around) only
+     // reports what it ended up as.
+    std::unordered_map<u64, std::pair<IRI, bool>> files;
+    UniqueArray<IRI> removed_folders;
+    bool lost = false;
+    double first_time = 0;
+    double last_time = 0;
+
+    bool empty () const {
+        return files.empty() && removed_folders.empty() && !lost;
+    }
+     // When this batch should be handed over, if nothing else happens.
+    double deadline () const {
+        return min(last_time + watch_quiet_time, first_time + watch_max_time);
+    }
+    void touch () {
+        last_time = uni::now();
+        if (!first_time) first_time = last_time;
+    }
+};
+
+} // namespace
+
+static bool is_under (const IRI& iri, const IRI& folder) {
+    Str spec = iri.spec();
+    Str prefix = folder.spec();
+    return spec.size() >= prefix.size()
+        && Str(spec.data(), prefix.size()) == prefix;
+}
+
+static bool wanted_extension (FolderWatcher& self, Str name) {
+    auto ext = ascii_to_lower(iri::path_extension(name));
+    for (auto& e : self.extensions) {
+        if (e == ext) return true;
+    }
+    return false;
+}
+
+static void set_file (Pending& pending, IRI file, bool present) {
+    u64 key = uni::hash64(file.spec());
+    pending.files.insert_or_assign(key, std::pair(move(file), present));
+    pending.touch();
+}
+
+ // Watch folder and all the folders under it.  If pending isn't null, the
+ // files in them are reported as added, because the folder itself is new.
+static void add_watches (
+    FolderWatcher& self, const IRI& folder, Pending* pending
+) {
+    UniqueString path = iri::to_fs_path(folder);
+    int wd = inotify_add_watch(self.inotify_fd, path.c_str(), watch_mask);
+    if (wd < 0) {
+        static bool warned = false;
+        if (errno == ENOSPC && !warned) {
+            warned = true;
+            ayu::warn_utf8(
+                "Ran out of inotify watches, so some folders won't be "
+                "watched.  Raise fs.inotify.max_user_watches to fix this.\n"
+            );
+        }
+        return;
+    }
+    self.watches.insert_or_assign(wd, folder);
+     // Read the folder after starting to watch it, so nothing falls in
+     // between.  Anything read here and also reported by an event is merged
+     // in Pending.
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    DIR* d = fdopendir(fd);
+    if (!d) { close(fd); return; }
+    while (dirent* ent = readdir(d)) {
+        Str name = ent->d_name;
+        if (name[0] == '.') continue;
+        bool is_dir;
+        switch (ent->d_type) {
+            case DT_DIR: is_dir = true; break;
+            case DT_REG: is_dir = false; break;
+            default: {
+                struct stat st;
+                is_dir = fstatat(fd, ent->d_name, &st, 0) == 0
+                      && S_ISDIR(st.st_mode);
+                break;
+            }
+        }
+        if (is_dir) {
+            add_watches(
+                self, iri::from_fs_path(cat(name, '/'), folder), pending
+            );
+        }
+        else if (pending && wanted_extension(self, name)) {
+            set_file(*pending, iri::from_fs_path(name, folder), true);
+        }
+    }
+    closedir(d);
+}
+
+static void remove_folder (
+    FolderWatcher& self, Pending& pending, const IRI& folder
+) {
+    for (auto it = self.watches.begin(); it != self.watches.end();) {
+        if (is_under(it->second, folder)) {
+             // Fails harmlessly if the folder was deleted, since the kernel
+             // already dropped the watch.
+            inotify_rm_watch(self.inotify_fd, it->first);
+            it = self.watches.erase(it);
+        }
+        else ++it;
+    }
+    for (auto it = pending.files.begin(); it != pending.files.end();) {
+        if (is_under(it->second.first, folder)) it = pending.files.erase(it);
+        else ++it;
+    }
+    pending.removed_folders.emplace_back(folder);
+    pending.touch();
+}
+
+static void handle_event (
+    FolderWatcher& self, Pending& pending, const inotify_event& ev
+) {
+    if (ev.mask & IN_Q_OVERFLOW) {
+        pending.lost = true;
+        pending.touch();
+        return;
+    }
+    if (ev.mask & IN_IGNORED) {
+        self.watches.erase(ev.wd);
+        return;
+    }
+    if (!ev.len) return;
+    auto it = self.watches.find(ev.wd);
+    if (it == self.watches.end()) return;
+    Str name = ev.name;
+    if (!name || name[0] == '.') return;
+     // Copy, because add_watches can rehash the map.
+    IRI folder = it->second;
+    if (ev.mask & IN_ISDIR) {
+        IRI sub = iri::from_fs_path(cat(name, '/'), folder);
+        if (ev.mask & (IN_CREATE | IN_MOVED_TO)) {
+            add_watches(self, sub, &pending);
+        }
+        else if (ev.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            remove_folder(self, pending, sub);
+        }
+        return;
+    }
+    if (!wanted_extension(self, name)) return;
+    IRI file = iri::from_fs_path(name, folder);
+    if (ev.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        set_file(pending, move(file), true);
+    }
+    else if (ev.mask & (IN_DELETE | IN_MOVED_FROM)) {
+        set_file(pending, move(file), false);
+    }
+}
+
+static void publish (FolderWatcher& self, Pending& pending) {
+    {
+        std::lock_guard lock (self.mutex);
+         // Copy so the main thread doesn't share any strings with this one.
+        for (auto& [_, entry] : pending.files) {
+            auto& [file, present] = entry;
+            auto& to = present ? self.ready.added : self.ready.removed;
+            to.emplace_back(IRI(cat(file.spec())));
+        }
+        for (auto& folder : pending.removed_folders) {
+            self.ready.removed_folders.emplace_back(IRI(cat(folder.spec())));
+        }
+        if (pending.lost) self.ready.lost = true;
+    }
+    pending = Pending();
+    wake_main_loop();
+}
+
+static void watch_thread (FolderWatcher& self) {
+    for (auto& root : self.roots) add_watches(self, root, null);
+    {
+        std::lock_guard lock (self.mutex);
+        self.watching = true;
+    }
+    self.watching_cond.notify_all();
+
+    Pending pending;
+    alignas(inotify_event) char buf [64 * 1024];
+    for (;;) {
+        int timeout = -1;
+        if (!pending.empty()) {
+            timeout = max(0, i32((pending.deadline() - uni::now()) * 1000) + 1);
+        }
+        pollfd fds [2] = {
+            {self.inotify_fd, POLLIN, 0},
+            {self.stop_fd, POLLIN, 0},
+        };
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) continue;
+            ayu::warn_utf8(cat(
+                "Stopped watching folders: ", std::strerror(errno), "\n"
+            ));
+            return;
+        }
+        if (fds[1].revents) return;
+        if (fds[0].revents & POLLIN) {
+            for (;;) {
+                isize len = read(self.inotify_fd, buf, sizeof(buf));
+                if (len <= 0) break;
+                for (isize i = 0; i < len;) {
+                    auto& ev = *(const inotify_event*)(buf + i);
+                    handle_event(self, pending, ev);
+                    i += sizeof(inotify_event) + ev.len;
+                }
+            }
+        }
+         // Check against the batch as it is after reading, so events that
+         // just arrived push the deadline back instead of sending the batch
+         // right away.
+        if (!pending.empty() && uni::now() >= pending.deadline()) {
+            publish(self, pending);
+        }
+    }
+}
+
+FolderWatcher::FolderWatcher (
+    Slice<IRI> folders, Slice<AnyString> exts
+) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        raise(e_General, cat(
+            "Could not start watching folders: ", std::strerror(errno)
+        ));
+    }
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        close(inotify_fd);
+        raise(e_General, cat(
+            "Could not start watching folders: ", std::strerror(errno)
+        ));
+    }
+     // Copy everything so the thread doesn't share any strings.
+    roots = UniqueArray<IRI>(folders.size(), [&](usize i){
+        return IRI(cat(folders[i].spec()));
+    });
+    extensions = UniqueArray<AnyString>(exts.size(), [&](usize i){
+        return AnyString(cat(exts[i]));
+    });
+    thread = std::thread([this]{ watch_thread(*this); });
+}
+
+FolderWatcher::~FolderWatcher () {
+    u64 one = 1;
+    [[maybe_unused]] auto _ = write(stop_fd, &one, sizeof(one));
+    thread.join();
+    close(stop_fd);
+    close(inotify_fd);
+}
+
+WatchChanges FolderWatcher::take_changes () {
+    std::lock_guard lock (mutex);
+    return move(ready);
+}
+
+void FolderWatcher::wait_until_watching () {
+    std::unique_lock lock (mutex);
+    watching_cond.wait(lock, [this]{ return watching; });
+}
+
+} using namespace liv;
+
+#ifndef TAP_DISABLE_TESTS
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include "../dirt/ayu/resources/resource.h"
+#include "../dirt/tap/tap.h"
+
+static tap::TestSet tests ("liv/watch", []{
+    using namespace tap;
+
+    IRI folder ("data:/test-watch/");
+    UniqueString base = ayu::resource_filename(folder);
+    std::error_code code;
+    fs::remove_all(base.c_str(), code);
+    fs::create_directories(cat(base, "/sub").c_str());
+    std::ofstream(cat(base, "/sub/old.png").c_str());
+    IRI fs_folder = iri::from_fs_path(cat(base, '/'));
+
+    AnyString exts [] = {"png"};
+    FolderWatcher watcher (Slice<IRI>(&fs_folder, 1), exts);
+    watcher.wait_until_watching();
+
+     // Collect changes until some arrive, or give up after a while.
+    auto wait_for_changes = [&]{
+        WatchChanges r;
+        for (i32 i = 0; i < 100 && r.empty(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            r = watcher.take_changes();
+        }
+        return r;
+    };
+
+    std::ofstream(cat(base, "/new.png").c_str());
+    std::ofstream(cat(base, "/new.txt").c_str());
+    auto changes = wait_for_changes();
+    is(changes.added.size(), usize(1), "Watcher reports a new page");
+    if (changes.added.size() == 1) {
+        ok(changes.added[0] == iri::from_fs_path(cat(base, "/new.png")),
+            "Watcher reports the right page"
+        );
+    }
+
+    fs::remove(cat(base, "/new.png").c_str(), code);
+    changes = wait_for_changes();
+    is(changes.removed.size(), usize(1), "Watcher reports a removed page");
+
+    fs::rename(cat(base, "/sub").c_str(), cat(base, "/.gone").c_str(), code);
+    changes = wait_for_changes();
+    is(changes.removed_folders.size(), usize(1),
+        "Watcher reports a folder moved away"
+    );
+
+    std::ofstream(cat(base, "/a.png").c_str());
+    fs::remove(cat(base, "/a.png").c_str(), code);
+    std::ofstream(cat(base, "/b.png").c_str());
+    changes = wait_for_changes();
+    ok(changes.added.size() == 1 && changes.removed.size() == 1,
+        "A page added and removed within a batch is only reported once"
+    );
+
+    fs::remove_all(base.c_str(), code);
+    done_testing();
+});
+#endif
@@ -0,0 +1,65 @@
+ // Watches a book's folders with inotify, so pages can be added and removed
+ // while the book is open.  Events are collected for a moment before they're
+ // handed over, so a big copy turns into a few batches instead of thousands of
+ // separate changes.
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "../dirt/iri/iri.h"
+#include "../dirt/uni/arrays.h"
+#include "../dirt/uni/common.h"
+#include "../dirt/uni/strings.h"
+#include "common.h"
+
+namespace liv {
+
+struct WatchChanges {
+     // Pages that appeared.  Files are only reported once they've been closed
+     // after writing or moved in, so half-written files aren't picked up.
+    UniqueArray<IRI> added;
+     // Pages that went away.
+    UniqueArray<IRI> removed;
+     // Folders that were moved away or deleted; every page under them is gone.
+    UniqueArray<IRI> removed_folders;
+     // Events were lost (the kernel's queue overflowed), so the folders need
+     // to be listed again.
+    bool lost = false;
+
+    bool empty () const {
+        return added.empty() && removed.empty() && removed_folders.empty()
+            && !lost;
+    }
+};
+
+struct FolderWatcher {
+     // Watches these folders and everything under them, for files with these
+     // extensions.  Starts watching on its own thread, so anything that
+     // changes before it gets to a folder is missed.
+    FolderWatcher (Slice<IRI> folders, Slice<AnyString> extensions);
+    ~FolderWatcher ();
+
+     // Take the batches that are ready.  Must be called from the main thread.
+    WatchChanges take_changes ();
+     // For testing.  Block until all the folders are being watched.
+    void wait_until_watching ();
+
+    int inotify_fd = -1;
+     // Written to stop the thread
+    int stop_fd = -1;
+    std::mutex mutex;
+    std::condition_variable watching_cond;
+    bool watching = false;
+    WatchChanges ready;
+    std::thread thread;
+
+     // Only used by the thread
+    UniqueArray<IRI> roots;
+    UniqueArray<AnyString> extensions;
+    std::unordered_map<int, IRI> watches;
+};
+
+} // namespace liv